@@ -0,0 +1,87 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  bench-concurrent.cc
+//
+//  Times ConcurrentStringTable::add_string with 1 to 64 threads.  Each of
+//  64 inputs interns 200K identifiers, 90% of them drawn from a vocabulary
+//  of 20K shared by every input and the rest its own.  Thread t interns
+//  inputs t, t + threads, ...; after number(), every index is checked
+//  against a sequential IdTable that interned the inputs in order.
+//
+//    bench-concurrent [inputs [identifiers-per-input [vocabulary]]]
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "cool-io.h"
+#include "stringtab.h"
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  int inputs = argc > 1 ? atoi(argv[1]) : 64;
+  int per_input = argc > 2 ? atoi(argv[2]) : 200000;
+  int vocabulary = argc > 3 ? atoi(argv[3]) : 20000;
+
+  // names[0, vocabulary) are shared; each input adds its own after them
+  std::vector<std::string> names;
+  for (int i = 0; i < vocabulary; i++)
+    names.push_back("v" + std::to_string(i));
+  std::vector<std::vector<uint32_t>> input(inputs);
+  uint64_t seed = 88172645463325252ull;
+  for (int in = 0; in < inputs; in++) {
+    for (int i = 0; i < per_input; i++) {
+      seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17; // xorshift64
+      if (seed % 10 == 0) {
+        input[in].push_back(names.size());
+        names.push_back("u" + std::to_string(in) + "_" + std::to_string(i));
+      } else {
+        input[in].push_back(seed / 10 % vocabulary);
+      }
+    }
+  }
+
+  IdTable sequential;
+  for (const std::vector<uint32_t> &in : input)
+    for (uint32_t n : in)
+      sequential.add_string(names[n]);
+
+  cout << "threads  ns/add  indices\n";
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    ConcurrentStringTable<IdEntry> table;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+      workers.emplace_back([&, t]() {
+        for (int in = t; in < inputs; in += threads) {
+          InternCursor cursor(in);
+          for (uint32_t n : input[in])
+            table.add_string(names[n], cursor);
+        }
+      });
+    for (std::thread &w : workers)
+      w.join();
+    double seconds = seconds_since(start);
+    table.number();
+
+    bool same = table.size() == sequential.size();
+    for (int i = 0; same && i < table.size(); i++)
+      same = table.lookup(i)->get_string() == sequential.lookup(i)->get_string();
+    cout << std::left << setw(9) << threads << std::right << std::fixed << std::setprecision(0) << setw(6)
+         << seconds * 1e9 / ((double)inputs * per_input) << "  " << (same ? "match" : "DIFFER") << endl;
+    if (!same) return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,76 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  bench-escape.cc
+//
+//  Times get_escaped_string on 200K generated string literals (about
+//  11 MB), once as plain text and once with an escape every ~10 bytes.
+//  Built twice by the Makefile: as bench-escape, which finds printable
+//  runs with SSE2, and as bench-escape-bytes, with __SSE2__ undefined so
+//  that printable_run falls back to its byte loop.
+//
+//    bench-escape [literals]
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#define RYML_SINGLE_HDR_DEFINE_NOW
+#include "ryml_all.hpp" // needs to be included first
+
+#include "cool-io.h"
+#include "utilities.h"
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// MB/s escaping every literal, best of a few runs
+static double throughput(const std::vector<std::string> &literals) {
+  size_t bytes = 0;
+  for (const std::string &s : literals)
+    bytes += s.length();
+  std::string out;
+  double best = 0;
+  for (int run = 0; run < 5; run++) {
+    auto start = std::chrono::steady_clock::now();
+    size_t written = 0;
+    for (const std::string &s : literals) {
+      get_escaped_string(s, out);
+      written += out.length();
+    }
+    double seconds = seconds_since(start);
+    if (written < bytes) abort(); // keeps the loop from being optimized away
+    best = std::max(best, bytes / seconds / 1e6);
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 200000;
+  static const char escapes[] = "\\\"\n\t\b\f\001\177";
+  uint64_t seed = 88172645463325252ull;
+  std::vector<std::string> plain, escaped;
+  for (long i = 0; i < n; i++) {
+    std::string s;
+    for (int len = 20 + i % 80; (int)s.length() < len;)
+      s += "The quick brown fox jumps over the lazy dog. "[s.length() % 45];
+    plain.push_back(s);
+    for (size_t at = 0; at < s.length(); at += 5 + seed % 11) {
+      seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17; // xorshift64
+      s[at] = escapes[seed % (sizeof(escapes) - 1)];
+    }
+    escaped.push_back(s);
+  }
+
+  cout << std::fixed << std::setprecision(0) << "plain text             " << setw(6) << throughput(plain)
+       << " MB/s\nan escape every ~10 B  " << setw(6) << throughput(escaped) << " MB/s" << endl;
+  return 0;
+}
@@ -0,0 +1,81 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  bench-nodes.cc
+//
+//  Reports what the AST nodes of a program cost.  It reads the AST the
+//  parser writes from stdin, counts the nodes of each class, and weighs
+//  them by the size of the class in this build, and by the malloc chunk
+//  that holds one.  Built twice by the Makefile, as bench-nodes and as
+//  bench-nodes-compact with COMPACT_SYMBOLS:
+//
+//    ./lexer good.cl | ./parser | ./bench-nodes
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#define RYML_SINGLE_HDR_DEFINE_NOW
+#include "ryml_all.hpp" // needs to be included first
+
+#include "cool-io.h"
+#include "cool-tree.h"
+#include <sstream>
+
+struct node_class {
+  const char *name; // as the parser writes it after class:
+  size_t size;
+  long count;
+};
+
+#define NODE(name) {#name, sizeof(name##_class), 0}
+
+static node_class nodes[] = {
+    NODE(program), NODE(class_), NODE(method), NODE(attr), NODE(formal), NODE(branch),
+    NODE(assign), NODE(static_dispatch), NODE(dispatch), NODE(cond), NODE(loop), NODE(typcase),
+    NODE(block), NODE(let), NODE(plus), NODE(sub), NODE(mul), NODE(divide),
+    NODE(neg), NODE(lt), NODE(eq), NODE(leq), NODE(comp), NODE(int_const),
+    NODE(bool_const), NODE(string_const), NODE(new_), NODE(isvoid), NODE(no_expr), NODE(object),
+};
+
+// the size of the glibc malloc chunk (on a 64-bit target) holding size bytes
+static size_t chunk(size_t size) {
+  return std::max<size_t>(32, (size + 8 + 15) & ~(size_t)15);
+}
+
+static void count(ryml::ConstNodeRef n) {
+  if (n.is_map() && n.has_child("class")) {
+    ryml::csubstr name = n["class"].val();
+    for (node_class &c : nodes)
+      if (name == c.name) c.count++;
+  }
+  for (ryml::ConstNodeRef child : n.children())
+    count(child);
+}
+
+int main() {
+  std::stringstream buffer;
+  buffer << std::cin.rdbuf();
+  std::string content = buffer.str();
+  if (!content.empty()) {
+    ryml::Tree tree = ryml::parse_in_place(ryml::to_substr(content));
+    count(tree.rootref());
+  }
+
+  long total = 0, bytes = 0, chunks = 0;
+  cout << "class             size  chunk  count\n";
+  for (const node_class &c : nodes) {
+    cout << std::left << setw(16) << c.name << std::right << setw(6) << c.size << setw(7) << chunk(c.size)
+         << setw(7) << c.count << endl;
+    total += c.count;
+    bytes += c.count * c.size;
+    chunks += c.count * chunk(c.size);
+  }
+  if (total > 0)
+    cout << total << " nodes, " << std::fixed << std::setprecision(1) << (double)bytes / total
+         << " bytes/node, " << (double)chunks / total << " bytes/node as malloc chunks" << endl;
+  return 0;
+}
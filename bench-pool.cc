@@ -0,0 +1,71 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  bench-pool.cc
+//
+//  Reports the heap the three string tables use.  It interns a generated
+//  corpus of identifiers, string constants (half of them spelled like an
+//  identifier) and integers into idtable, stringtable and inttable, and
+//  prints the heap growth measured with mallinfo2.  Built twice by the
+//  Makefile: as bench-pool, with the tables sharing one StringPool, and as
+//  bench-pool-per-table with PER_TABLE_POOL, where each has its own.
+//
+//    bench-pool [identifiers [strings [integers]]]
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "cool-io.h"
+#include "stringtab.h"
+#include <malloc.h>
+#include <stdlib.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+static size_t heap_bytes() {
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+int main(int argc, char *argv[]) {
+  long identifiers = argc > 1 ? atol(argv[1]) : 200000;
+  long strings = argc > 2 ? atol(argv[2]) : 200000;
+  long integers = argc > 3 ? atol(argv[3]) : 50000;
+
+  std::vector<std::string> ids, strs, ints;
+  for (long i = 0; i < identifiers; i++)
+    ids.push_back("identifier_" + std::to_string(i));
+  for (long i = 0; i < strings; i++)
+    strs.push_back(i % 2 ? ids[i % identifiers] : "a string constant, number " + std::to_string(i));
+  for (long i = 0; i < integers; i++)
+    ints.push_back(std::to_string(i * 7919));
+
+  size_t unique = 0;
+  {
+    std::unordered_set<std::string> seen;
+    for (const std::vector<std::string> *v : {&ids, &strs, &ints})
+      for (const std::string &s : *v)
+        if (seen.insert(s).second) unique += s.length();
+  }
+
+  size_t before = heap_bytes();
+  int entries = idtable.size() + stringtable.size() + inttable.size();
+  for (const std::string &s : ids)
+    idtable.add_string(s);
+  for (const std::string &s : strs)
+    stringtable.add_string(s);
+  for (const std::string &s : ints)
+    inttable.add_string(s);
+  size_t used = heap_bytes() - before;
+  entries = idtable.size() + stringtable.size() + inttable.size() - entries;
+
+  cout << entries << " entries, " << unique << " unique bytes\n"
+       << used << " heap bytes, " << std::fixed << std::setprecision(1) << (double)used / entries
+       << " B/entry" << endl;
+  return 0;
+}
@@ -0,0 +1,58 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  bench-stringtab.cc
+//
+//  Times StringTable::add_string: N distinct symbols are interned into a
+//  fresh table, then interned again, for each N given on the command line
+//  (by default 1K, 10K, 100K, 1M and 10M).  Built and run by make bench.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "cool-io.h"
+#include "stringtab.h"
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<long> sizes;
+  for (int i = 1; i < argc; i++)
+    sizes.push_back(atol(argv[i]));
+  if (sizes.empty()) sizes = {1000, 10000, 100000, 1000000, 10000000};
+
+  cout << "symbols    ns/add (new)  ns/add (present)\n";
+  for (long n : sizes) {
+    // the names are made up front so that only interning is timed
+    std::vector<std::string> names(n);
+    for (long i = 0; i < n; i++)
+      names[i] = "sym" + std::to_string(i * 2654435761u % 4294967291u);
+
+    IdTable table;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string &s : names)
+      table.add_string(s);
+    double added = seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    for (const std::string &s : names)
+      table.add_string(s);
+    double found = seconds_since(start);
+    if (table.size() != n) {
+      cerr << "expected " << n << " entries, got " << table.size() << endl;
+      return 1;
+    }
+    cout << std::left << setw(11) << n << std::right << std::fixed << std::setprecision(0) << setw(12)
+         << added * 1e9 / n << setw(18) << found * 1e9 / n << endl;
+  }
+  return 0;
+}
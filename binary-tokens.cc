@@ -0,0 +1,83 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  binary-tokens.cc
+//
+//  Converts a YAML token stream into the binary format of cool-yaml.h,
+//  the way a lexer would write it: each token is turned into the value
+//  the lexer holds for it (with its symbol interned) and handed to
+//  build_binary_token, and the stream is written with write_binary_tokens.
+//  binary-harness (make binary-check) parses both streams and compares.
+//
+//    binary-tokens < tokens.yaml > tokens.bin
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#define RYML_SINGLE_HDR_DEFINE_NOW
+#include "ryml_all.hpp" // needs to be included first
+
+#include "cool-io.h"
+#include "cool-parse.h"
+#include "stringtab.h"
+#include "utilities.h"
+#include <deque>
+#include <sstream>
+
+int main() {
+  std::stringstream buffer;
+  buffer << std::cin.rdbuf();
+  std::string content = buffer.str();
+  ryml::Tree tree = ryml::parse_in_place(ryml::to_substr(content));
+  ryml::ConstNodeRef root = tree.rootref();
+  if (!root.is_map() || !root.has_child("name") || !root.has_child("tokens")) {
+    cerr << "expected a token stream with a name and tokens" << endl;
+    return 1;
+  }
+
+  std::string name;
+  root["name"] >> name;
+  binary_token_stream tokens(name);
+  std::string unescaped;
+  std::deque<std::string> errors; // the messages of ERROR tokens
+  size_t pos = 0;
+  for (ryml::ConstNodeRef node : root["tokens"].children()) {
+    int kind = node.has_child("kind") ? cool_token_from_string(node["kind"].val()) : -1;
+    if (kind < 0 || !node.has_child("lineno")) {
+      cerr << "invalid token #" << pos << endl;
+      return 1;
+    }
+    int lineno;
+    node["lineno"] >> lineno;
+    std::string_view symbol;
+    if (node.has_child("symbol")) symbol = std::string_view(node["symbol"].val().str, node["symbol"].val().len);
+
+    YYSTYPE value = {};
+    switch (kind) {
+    case STR_CONST:
+      get_unescaped_string(symbol, unescaped);
+      value.symbol = stringtable.add_string(unescaped);
+      break;
+    case INT_CONST: value.symbol = inttable.add_string(symbol); break;
+    case TYPEID:
+    case OBJECTID: value.symbol = idtable.add_string(symbol); break;
+    case BOOL_CONST: {
+      bool b = false;
+      if (node.has_child("boolean")) node["boolean"] >> b;
+      value.boolean = b;
+      break;
+    }
+    case ERROR:
+      value.error_msg = symbol == "\\000" ? "" : errors.emplace_back(get_unescaped_string(symbol)).c_str();
+      break;
+    }
+    build_binary_token(lineno, kind, value, tokens);
+    pos++;
+  }
+  write_binary_tokens(cout, tokens);
+  return 0;
+}
@@ -83,6 +83,17 @@ typedef Cases_class *Cases;
 #if YYDEBUG
 extern int cool_yydebug;
 #endif
+/* "%code requires" blocks.  */
+#line 6 "cool.y"
+
+#include "cool-tree.h"
+#include "parse-context.h"
+
+/* Locations */
+#define YYLTYPE int              /* the type of locations: the line number
+                                    the lexer gives each token */
+
+#line 58 "cool.tab.h"
 
 /* Token kinds.  */
 #ifndef YYTOKENTYPE
@@ -118,8 +129,7 @@ extern int cool_yydebug;
     ASSIGN = 280,                  /* ASSIGN  */
     NOT = 281,                     /* NOT  */
     LE = 282,                      /* LE  */
-    ERROR = 283,                   /* ERROR  */
-    LET_STMT = 285                 /* LET_STMT  */
+    ERROR = 283                    /* ERROR  */
   };
   typedef enum yytokentype yytoken_kind_t;
 #endif
@@ -154,13 +164,12 @@ extern int cool_yydebug;
 #define NOT 281
 #define LE 282
 #define ERROR 283
-#define LET_STMT 285
 
 /* Value type.  */
 #if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
 union YYSTYPE
 {
-#line 50 "cool.y"
+#line 67 "cool.y"
 
   Boolean boolean;
   Symbol symbol;
@@ -177,7 +186,7 @@ union YYSTYPE
   Expressions expressions;
   const char *error_msg;
 
-#line 142 "cool.tab.h"
+#line 151 "cool.tab.h"
 
 };
 typedef union YYSTYPE YYSTYPE;
@@ -200,10 +209,25 @@ struct YYLTYPE
 #endif
 
 
-extern YYSTYPE cool_yylval;
-extern YYLTYPE cool_yylloc;
 
-int cool_yyparse (void);
+
+#ifndef YYPUSH_MORE_DEFINED
+# define YYPUSH_MORE_DEFINED
+enum { YYPUSH_MORE = 4 };
+#endif
+
+typedef struct cool_yypstate cool_yypstate;
+
+
+int cool_yyparse (ParseContext *ctx);
+
+/* The lexer cool_yyparse calls; defined in parser-adapter.cc.  */
+int cool_yylex (YYSTYPE *yylval, YYLTYPE *yylloc, ParseContext *ctx);
+int cool_yypush_parse (cool_yypstate *ps,
+                  int pushed_char, YYSTYPE const *pushed_val, YYLTYPE *pushed_loc, ParseContext *ctx);
+int cool_yypull_parse (cool_yypstate *ps, ParseContext *ctx);
+cool_yypstate *cool_yypstate_new (void);
+void cool_yypstate_delete (cool_yypstate *ps);
 
 
 #endif /* !YY_COOL_YY_COOL_TAB_H_INCLUDED  */
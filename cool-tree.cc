@@ -15,7 +15,7 @@
 
 // This implements the helper to convert a arbitrary list of AST nodes to a YAML
 // sequence. We use a template function so that different phylums are supported.
-template <typename phylum, typename = std::enable_if_t<std::is_base_of_v<tree_node, phylum>>>
+template <typename phylum, typename>
 void list_to_yaml(std::list<phylum *> *tree_nodes, ryml::NodeRef *n) {
   *n |= ryml::SEQ;
   static_assert(std::is_base_of<tree_node, phylum>::value);
@@ -46,6 +46,13 @@ void emit_lineno(tree_node const *t, ryml::NodeRef *n) {
   n->append_child() << ryml::key("lineno") << t->get_line_number();
 }
 
+void emit_symbol(ryml::NodeRef *n, ryml::csubstr key, Symbol sym) {
+  assert(n->is_map());
+  ryml::NodeRef child = n->append_child();
+  child.set_key(key);
+  child.set_val(to_csubstr(sym));
+}
+
 void emit_yaml(std::ostream &o, tree_node const *t) {
   ryml::Tree wtree;
   ryml::NodeRef wroot = wtree.rootref();
@@ -90,11 +97,11 @@ void class__class::to_yaml(ryml::NodeRef *n) const {
   *n |= ryml::MAP;
   emit_lineno(this, n);
   n->append_child() << ryml::key("class") << "class_";
-  n->append_child() << ryml::key("name") << name->get_string();
-  n->append_child() << ryml::key("parent") << parent->get_string();
+  emit_symbol(n, "name", name);
+  emit_symbol(n, "parent", parent);
   ryml::NodeRef features_node = (*n)["features"];
   list_to_yaml<Feature>(features, &features_node);
-  n->append_child() << ryml::key("filename") << filename->get_string();
+  emit_symbol(n, "filename", filename);
 }
 
 Feature *method_class::copy_Feature() {
@@ -108,10 +115,10 @@ void method_class::to_yaml(ryml::NodeRef *n) const {
   *n |= ryml::MAP;
   emit_lineno(this, n);
   n->append_child() << ryml::key("class") << "method";
-  n->append_child() << ryml::key("name") << name->get_string();
+  emit_symbol(n, "name", name);
   ryml::NodeRef formals_node = (*n)["formals"];
   list_to_yaml<Formal>(formals, &formals_node);
-  n->append_child() << ryml::key("return_type") << return_type->get_string();
+  emit_symbol(n, "return_type", return_type);
   ryml::NodeRef expr_node = (*n)["expr"];
   expr->to_yaml(&expr_node);
 }
@@ -124,8 +131,8 @@ void attr_class::to_yaml(ryml::NodeRef *n) const {
   *n |= ryml::MAP;
   emit_lineno(this, n);
   n->append_child() << ryml::key("class") << "attr";
-  n->append_child() << ryml::key("name") << name->get_string();
-  n->append_child() << ryml::key("type_decl") << type_decl->get_string();
+  emit_symbol(n, "name", name);
+  emit_symbol(n, "type_decl", type_decl);
   ryml::NodeRef init_node = (*n)["init"];
   init->to_yaml(&init_node);
 }
@@ -138,8 +145,8 @@ void formal_class::to_yaml(ryml::NodeRef *n) const {
   *n |= ryml::MAP;
   emit_lineno(this, n);
   n->append_child() << ryml::key("class") << "formal";
-  n->append_child() << ryml::key("name") << name->get_string();
-  n->append_child() << ryml::key("type_decl") << type_decl->get_string();
+  emit_symbol(n, "name", name);
+  emit_symbol(n, "type_decl", type_decl);
 }
 
 Case *branch_class::copy_Case() {
@@ -150,8 +157,8 @@ void branch_class::to_yaml(ryml::NodeRef *n) const {
   *n |= ryml::MAP;
   emit_lineno(this, n);
   n->append_child() << ryml::key("class") << "branch";
-  n->append_child() << ryml::key("name") << name->get_string();
-  n->append_child() << ryml::key("type_decl") << type_decl->get_string();
+  emit_symbol(n, "name", name);
+  emit_symbol(n, "type_decl", type_decl);
   ryml::NodeRef expr_node = (*n)["expr"];
   expr->to_yaml(&expr_node);
 }
@@ -161,11 +168,8 @@ void branch_class::to_yaml(ryml::NodeRef *n) const {
 // defining it inside the implementation but not on the Expression class
 void emit_type(Expression const *e, ryml::NodeRef *n) {
   assert(n->is_map());
-  if (e->type) {
-    n->append_child() << ryml::key("type") << e->type->get_string();
-  } else {
-    n->append_child() << ryml::key("type") << "_no_type";
-  }
+  Symbol type = e->type;
+  emit_symbol(n, "type", type ? type : sym_no_type);
 }
 
 Expression *assign_class::copy_Expression() {
@@ -177,7 +181,7 @@ void assign_class::to_yaml(ryml::NodeRef *n) const {
   emit_lineno(this, n);
   emit_type(this, n);
   n->append_child() << ryml::key("class") << "assign";
-  n->append_child() << ryml::key("name") << name->get_string();
+  emit_symbol(n, "name", name);
   ryml::NodeRef expr_node = (*n)["expr"];
   expr->to_yaml(&expr_node);
 }
@@ -196,8 +200,8 @@ void static_dispatch_class::to_yaml(ryml::NodeRef *n) const {
   n->append_child() << ryml::key("class") << "static_dispatch";
   ryml::NodeRef expr_node = (*n)["expr"];
   expr->to_yaml(&expr_node);
-  n->append_child() << ryml::key("type_name") << type_name->get_string();
-  n->append_child() << ryml::key("name") << name->get_string();
+  emit_symbol(n, "type_name", type_name);
+  emit_symbol(n, "name", name);
   ryml::NodeRef actual_node = (*n)["actual"];
   list_to_yaml<Expression>(actual, &actual_node);
 }
@@ -213,7 +217,7 @@ void dispatch_class::to_yaml(ryml::NodeRef *n) const {
   n->append_child() << ryml::key("class") << "dispatch";
   ryml::NodeRef expr_node = (*n)["expr"];
   expr->to_yaml(&expr_node);
-  n->append_child() << ryml::key("name") << name->get_string();
+  emit_symbol(n, "name", name);
   ryml::NodeRef actual_node = (*n)["actual"];
   list_to_yaml<Expression>(actual, &actual_node);
 }
@@ -292,8 +296,8 @@ void let_class::to_yaml(ryml::NodeRef *n) const {
   emit_lineno(this, n);
   emit_type(this, n);
   n->append_child() << ryml::key("class") << "let";
-  n->append_child() << ryml::key("identifier") << identifier->get_string();
-  n->append_child() << ryml::key("type_decl") << type_decl->get_string();
+  emit_symbol(n, "identifier", identifier);
+  emit_symbol(n, "type_decl", type_decl);
   ryml::NodeRef init_node = (*n)["init"];
   init->to_yaml(&init_node);
   ryml::NodeRef body_node = (*n)["body"];
@@ -440,7 +444,7 @@ void int_const_class::to_yaml(ryml::NodeRef *n) const {
   emit_lineno(this, n);
   emit_type(this, n);
   n->append_child() << ryml::key("class") << "int_const";
-  n->append_child() << ryml::key("token") << token->get_string();
+  emit_symbol(n, "token", token);
 }
 
 Expression *bool_const_class::copy_Expression() {
@@ -464,7 +468,7 @@ void string_const_class::to_yaml(ryml::NodeRef *n) const {
   emit_lineno(this, n);
   emit_type(this, n);
   n->append_child() << ryml::key("class") << "string_const";
-  n->append_child() << ryml::key("token") << token->get_string();
+  emit_symbol(n, "token", token);
 }
 
 Expression *new__class::copy_Expression() {
@@ -476,7 +480,7 @@ void new__class::to_yaml(ryml::NodeRef *n) const {
   emit_lineno(this, n);
   emit_type(this, n);
   n->append_child() << ryml::key("class") << "new_";
-  n->append_child() << ryml::key("type_name") << type_name->get_string();
+  emit_symbol(n, "type_name", type_name);
 }
 
 Expression *isvoid_class::copy_Expression() {
@@ -512,7 +516,7 @@ void object_class::to_yaml(ryml::NodeRef *n) const {
   emit_lineno(this, n);
   emit_type(this, n);
   n->append_child() << ryml::key("class") << "object";
-  n->append_child() << ryml::key("name") << name->get_string();
+  emit_symbol(n, "name", name);
 }
 
 // interfaces used by Bison
@@ -589,12 +593,17 @@ std::string *get_string_val(ryml::ConstNodeRef const &node) {
   return new std::string(node.val().str, node.val().len);
 }
 
+// A view of the scalar for interning; the table copies the bytes it keeps.
+std::string_view get_symbol_val(ryml::ConstNodeRef const &node) {
+  return std::string_view(node.val().str, node.val().len);
+}
+
 void fail() {
   fprintf(stderr, "failed\n");
   exit(1);
 }
 
-extern int node_lineno;
+extern thread_local int node_lineno;
 
 int set_lineno(ryml::ConstNodeRef const &node) {
   int prev_lineno = node_lineno;
@@ -625,11 +634,11 @@ Class_ *yaml_to_class_(ryml::ConstNodeRef const &node) {
   int prev_lineno = set_lineno(node);
   Class_ *class_obj = NULL;
   if (tree_node_class->compare("class_") == 0) {
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
-    Symbol parent = idtable.add_string(get_string_val(node["parent"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
+    Symbol parent = idtable.add_string(get_symbol_val(node["parent"]));
     std::list<Feature *> *features = new std::list<Feature *>();
     yaml_to_list<Feature>(features, &yaml_to_feature, node["features"]);
-    Symbol filename = stringtable.add_string(get_string_val(node["filename"])->c_str());
+    Symbol filename = stringtable.add_string(get_symbol_val(node["filename"]));
     class_obj = class_(name, parent, features, filename);
   }
   // We need to restore node_lineno before returning,
@@ -646,15 +655,15 @@ Feature *yaml_to_feature(ryml::ConstNodeRef const &node) {
   int prev_lineno = set_lineno(node);
   Feature *feature = NULL;
   if (tree_node_class->compare("method") == 0) {
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
     std::list<Formal *> *formals = new std::list<Formal *>();
     yaml_to_list<Formal>(formals, &yaml_to_formal, node["formals"]);
-    Symbol return_type = idtable.add_string(get_string_val(node["return_type"])->c_str());
+    Symbol return_type = idtable.add_string(get_symbol_val(node["return_type"]));
     Expression *expr = yaml_to_expression(node["expr"]);
     feature = method(name, formals, return_type, expr);
   } else if (tree_node_class->compare("attr") == 0) {
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
-    Symbol type_decl = idtable.add_string(get_string_val(node["type_decl"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
+    Symbol type_decl = idtable.add_string(get_symbol_val(node["type_decl"]));
     Expression *init = yaml_to_expression(node["init"]);
     feature = attr(name, type_decl, init);
   }
@@ -672,8 +681,8 @@ Formal *yaml_to_formal(ryml::ConstNodeRef const &node) {
   int prev_lineno = set_lineno(node);
   Formal *formal_obj = NULL;
   if (tree_node_class->compare("formal") == 0) {
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
-    Symbol type_decl = idtable.add_string(get_string_val(node["type_decl"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
+    Symbol type_decl = idtable.add_string(get_symbol_val(node["type_decl"]));
     formal_obj = formal(name, type_decl);
   }
   // We need to restore node_lineno before returning,
@@ -690,8 +699,8 @@ Case *yaml_to_case(ryml::ConstNodeRef const &node) {
   int prev_lineno = set_lineno(node);
   Case *branch_obj = NULL;
   if (tree_node_class->compare("branch") == 0) {
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
-    Symbol type_decl = idtable.add_string(get_string_val(node["type_decl"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
+    Symbol type_decl = idtable.add_string(get_symbol_val(node["type_decl"]));
     Expression *expr = yaml_to_expression(node["expr"]);
     branch_obj = branch(name, type_decl, expr);
   }
@@ -709,19 +718,19 @@ Expression *yaml_to_expression(ryml::ConstNodeRef const &node) {
   int prev_lineno = set_lineno(node);
   Expression *expression = NULL;
   if (tree_node_class->compare("assign") == 0) {
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
     Expression *expr = yaml_to_expression(node["expr"]);
     expression = assign(name, expr);
   } else if (tree_node_class->compare("static_dispatch") == 0) {
     Expression *expr = yaml_to_expression(node["expr"]);
-    Symbol type_name = idtable.add_string(get_string_val(node["type_name"])->c_str());
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
+    Symbol type_name = idtable.add_string(get_symbol_val(node["type_name"]));
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
     std::list<Expression *> *actual = new std::list<Expression *>();
     yaml_to_list<Expression>(actual, &yaml_to_expression, node["actual"]);
     expression = static_dispatch(expr, type_name, name, actual);
   } else if (tree_node_class->compare("dispatch") == 0) {
     Expression *expr = yaml_to_expression(node["expr"]);
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
     std::list<Expression *> *actual = new std::list<Expression *>();
     yaml_to_list<Expression>(actual, &yaml_to_expression, node["actual"]);
     expression = dispatch(expr, name, actual);
@@ -744,8 +753,8 @@ Expression *yaml_to_expression(ryml::ConstNodeRef const &node) {
     yaml_to_list<Expression>(body, &yaml_to_expression, node["body"]);
     expression = block(body);
   } else if (tree_node_class->compare("let") == 0) {
-    Symbol identifier = idtable.add_string(get_string_val(node["identifier"])->c_str());
-    Symbol type_decl = idtable.add_string(get_string_val(node["type_decl"])->c_str());
+    Symbol identifier = idtable.add_string(get_symbol_val(node["identifier"]));
+    Symbol type_decl = idtable.add_string(get_symbol_val(node["type_decl"]));
     Expression *init = yaml_to_expression(node["init"]);
     Expression *body = yaml_to_expression(node["body"]);
     expression = let(identifier, type_decl, init, body);
@@ -784,23 +793,23 @@ Expression *yaml_to_expression(ryml::ConstNodeRef const &node) {
     Expression *e1 = yaml_to_expression(node["e1"]);
     expression = comp(e1);
   } else if (tree_node_class->compare("int_const") == 0) {
-    Symbol token = inttable.add_string(get_string_val(node["token"])->c_str());
+    Symbol token = inttable.add_string(get_symbol_val(node["token"]));
     expression = int_const(token);
   } else if (tree_node_class->compare("bool_const") == 0) {
     expression = bool_const(node["val"].val() == "1" ? 1 : 0);
   } else if (tree_node_class->compare("string_const") == 0) {
-    Symbol token = stringtable.add_string(get_string_val(node["token"])->c_str());
+    Symbol token = stringtable.add_string(get_symbol_val(node["token"]));
     expression = string_const(token);
   } else if (tree_node_class->compare("isvoid") == 0) {
     Expression *e1 = yaml_to_expression(node["e1"]);
     expression = isvoid(e1);
   } else if (tree_node_class->compare("new_") == 0) {
-    Symbol type_name = idtable.add_string(get_string_val(node["type_name"])->c_str());
+    Symbol type_name = idtable.add_string(get_symbol_val(node["type_name"]));
     expression = new_(type_name);
   } else if (tree_node_class->compare("no_expr") == 0) {
     expression = no_expr();
   } else if (tree_node_class->compare("object") == 0) {
-    Symbol name = idtable.add_string(get_string_val(node["name"])->c_str());
+    Symbol name = idtable.add_string(get_symbol_val(node["name"]));
     expression = object(name);
   }
   // We need to restore node_lineno before returning,
@@ -810,7 +819,7 @@ Expression *yaml_to_expression(ryml::ConstNodeRef const &node) {
     std::cerr << "Invalid class: " << tree_node_class << endl;
     fail();
   }
-  expression->set_type(idtable.add_string(get_string_val(node["type"])->c_str()));
+  expression->set_type(idtable.add_string(get_symbol_val(node["type"])));
   return expression;
 }
 
@@ -123,10 +123,10 @@ public:
 // define constructor - class_
 class class__class : public Class_ {
 protected:
-  Symbol name;
-  Symbol parent;
+  SymbolField name;
+  SymbolField parent;
   Features features;
-  Symbol filename;
+  SymbolField filename;
 
 public:
   class__class(Symbol a1, Symbol a2, Features a3, Symbol a4) :
@@ -145,9 +145,9 @@ public:
 // define constructor - method
 class method_class : public Feature {
 protected:
-  Symbol name;
+  SymbolField name;
   Formals formals;
-  Symbol return_type;
+  SymbolField return_type;
   Expression *expr;
 
 public:
@@ -167,8 +167,8 @@ public:
 // define constructor - attr
 class attr_class : public Feature {
 protected:
-  Symbol name;
-  Symbol type_decl;
+  SymbolField name;
+  SymbolField type_decl;
   Expression *init;
 
 public:
@@ -187,8 +187,8 @@ public:
 // define constructor - formal
 class formal_class : public Formal {
 protected:
-  Symbol name;
-  Symbol type_decl;
+  SymbolField name;
+  SymbolField type_decl;
 
 public:
   formal_class(Symbol a1, Symbol a2) : name(a1), type_decl(a2) {}
@@ -206,8 +206,8 @@ public:
 // define constructor - branch
 class branch_class : public Case {
 protected:
-  Symbol name;
-  Symbol type_decl;
+  SymbolField name;
+  SymbolField type_decl;
   Expression *expr;
 
 public:
@@ -226,7 +226,7 @@ public:
 // define constructor - assign
 class assign_class : public Expression {
 protected:
-  Symbol name;
+  SymbolField name;
   Expression *expr;
 
 public:
@@ -246,8 +246,8 @@ public:
 class static_dispatch_class : public Expression {
 protected:
   Expression *expr;
-  Symbol type_name;
-  Symbol name;
+  SymbolField type_name;
+  SymbolField name;
   Expressions actual;
 
 public:
@@ -268,7 +268,7 @@ public:
 class dispatch_class : public Expression {
 protected:
   Expression *expr;
-  Symbol name;
+  SymbolField name;
   Expressions actual;
 
 public:
@@ -364,8 +364,8 @@ public:
 // define constructor - let
 class let_class : public Expression {
 protected:
-  Symbol identifier;
-  Symbol type_decl;
+  SymbolField identifier;
+  SymbolField type_decl;
   Expression *init;
   Expression *body;
 
@@ -555,7 +555,7 @@ public:
 // define constructor - int_const
 class int_const_class : public Expression {
 protected:
-  Symbol token;
+  SymbolField token;
 
 public:
   int_const_class(Symbol a1) : token(a1) {}
@@ -591,7 +591,7 @@ public:
 // define constructor - string_const
 class string_const_class : public Expression {
 protected:
-  Symbol token;
+  SymbolField token;
 
 public:
   string_const_class(Symbol a1) : token(a1) {}
@@ -609,7 +609,7 @@ public:
 // define constructor - new_
 class new__class : public Expression {
 protected:
-  Symbol type_name;
+  SymbolField type_name;
 
 public:
   new__class(Symbol a1) : type_name(a1) {}
@@ -661,7 +661,7 @@ public:
 // define constructor - object
 class object_class : public Expression {
 protected:
-  Symbol name;
+  SymbolField name;
 
 public:
   object_class(Symbol a1) : name(a1) {}
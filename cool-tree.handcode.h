@@ -25,6 +25,14 @@ inline void assert_Boolean(Boolean) {}
 void assert_Symbol(Symbol b);
 Symbol copy_Symbol(Symbol b);
 
+// The type of the Symbol fields of AST nodes.  With COMPACT_SYMBOLS the
+// nodes store 32-bit SymbolHandles instead of 64-bit Entry pointers.
+#ifdef COMPACT_SYMBOLS
+typedef SymbolHandle SymbolField;
+#else
+typedef Symbol SymbolField;
+#endif
+
 
 typedef std::list<Class_ *> Classes_class;
 typedef Classes_class *Classes;
@@ -70,15 +78,22 @@ typedef Cases_class *Cases;
 #define branch_EXTRAS                                             \
 
 #define Expression_EXTRAS                                                    \
-  Symbol type;                                                               \
+  SymbolField type;                                                          \
   Symbol get_type() { return type; }                                         \
   Expression *set_type(Symbol s) {                                           \
     type = s;                                                                \
     return this;                                                             \
   }                                                                          \
-  Expression() { type = (Symbol)NULL; }
+  Expression() : type((Symbol)NULL) {}
 
 #define Expression_SHARED_EXTRAS                                 \
 
 
+#define let_EXTRAS                                                           \
+  Expression *set_body(Expression *e) {                                      \
+    body = e;                                                                \
+    return this;                                                             \
+  }
+
+
 #endif
@@ -3,11 +3,50 @@
 #ifndef _COOL_YAML_H_
 #define _COOL_YAML_H_
 
+#include <stdint.h>
+#include <string_view>
+
+//
+// A token as the parser reads it.  symbol is a view into the input (or
+// into the ryml tree built over it), so it is valid only until the next
+// token is read; the lexer interns it before then.
+//
 struct token {
   int kind;
   unsigned int lineno;
-  std::string symbol;
+  std::string_view symbol;
   bool boolean;
 };
 
+//
+// The binary token stream, which the parser tells from YAML by its magic
+// number.  All fields are native 32-bit words:
+//
+//   magic                  "COOLTOK1"
+//   count                  the number of tokens
+//   name_len               the length of the file name, which starts the
+//                          string section
+//   strings_size           the size of the string section
+//   records[count]         one binary_token per token
+//   strings[strings_size]  the symbols, as they are written in YAML
+//
+// A symbol is the offset and length of its bytes in the string section.
+// BOOL_CONST keeps its value in offset, with a length of 0.
+//
+#define BINARY_TOKEN_MAGIC "COOLTOK1"
+
+struct binary_token_header {
+  char magic[8];
+  uint32_t count;
+  uint32_t name_len;
+  uint32_t strings_size;
+};
+
+struct binary_token {
+  int32_t kind;
+  uint32_t lineno;
+  uint32_t offset;
+  uint32_t length;
+};
+
 #endif
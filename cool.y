@@ -3,23 +3,28 @@
  *              Parser definition for the COOL language.
  *
  */
+%code requires {
+#include "cool-tree.h"
+#include "parse-context.h"
+
+/* Locations */
+#define YYLTYPE int              /* the type of locations: the line number
+                                    the lexer gives each token */
+}
+
 %{
 #include <iostream>
 #include "cool-tree.h"
 #include "stringtab.h"
-#include "utilities.h"
 
-/* memory */
+/* memory: the list rules below are left-recursive, so only nesting
+   uses up the stacks, not the length of a class or a block */
 #define YYINITDEPTH 10000
 #define YYMAXDEPTH 10000
 
-/* Locations */
-#define YYLTYPE int              /* the type of locations */
-#define cool_yylloc curr_lineno  /* use the curr_lineno from the lexer
-                                    for the location of tokens */
-extern int node_lineno;          /* set before constructing a tree node
-                                    to whatever you want the line number
-                                    for the tree node to be */
+extern thread_local int node_lineno; /* set before constructing a tree node
+                                        to whatever you want the line number
+                                        for the tree node to be */
 
 /* The default action for locations.  Use the location of the first
    terminal/non-terminal and set the node_lineno to that value. */
@@ -30,15 +35,33 @@ extern int node_lineno;          /* set before constructing a tree node
 #define SET_NODELOC(Current)  \
   node_lineno = Current;
 
-extern char *curr_filename;
+%}
 
-void yyerror(const char *s);        /*  defined below; called for each parse error */
-extern int yylex();           /*  the entry point to the lexer  */
-Program *ast_root;	      /* the result of the parse  */
-Classes parse_results;        /* for use in semantic analysis */
-int omerrs = 0;               /* number of erros in lexing and parsing */
+/* The parser is pure: everything a parse changes is in its ParseContext
+   (see parse-context.h), which the parser and the lexer are passed. */
+%define api.pure full
+%define api.push-pull both
+%locations
+%parse-param {ParseContext *ctx}
+%lex-param {ParseContext *ctx}
 
-%}
+%code {
+#include "utilities.h"
+
+int yylex(YYSTYPE *yylval, YYLTYPE *yylloc, ParseContext *ctx); /* the entry point to the lexer */
+
+/* Called for each parse error, with the lookahead token and its value,
+   which the report prints. */
+void report_parse_error(int lineno, ParseContext *ctx, const char *s, int token, const YYSTYPE &value);
+
+/* yyerror is left only the parser running out of memory (see
+   parse.error below), which is reported with no lookahead. */
+static void yyerror(YYLTYPE *loc, ParseContext *ctx, const char *s);
+}
+
+/* Syntax errors go to yyreport_syntax_error, which is given the
+   lookahead. */
+%define parse.error custom
 
 /* A union of all the types that can be the result of parsing actions. */
 %union {
@@ -95,12 +118,16 @@ int omerrs = 0;               /* number of erros in lexing and parsing */
 /* %type <features> dummy_feature_list */
 %type <features> feature_list
 %type <features> features
+%type <features> feature_seq
 %type <feature> feature
 %type <expressions> expression_list
 %type <expressions> expression_block
+%type <expressions> expression_seq
 %type <expression> expression 
-%type <expression> let_exp
+%type <expressions> let_bindings
+%type <expression> let_binding
 %type <formals> formal_list
+%type <formals> formals
 %type <formal> formal
 %type <case_> case /* moved branch from expression to case_ */
 %type <cases> case_list
@@ -129,20 +156,20 @@ int omerrs = 0;               /* number of erros in lexing and parsing */
 */
 program     : class_list  { /* make sure bison computes location information */
                 @$ = @1;
-                ast_root = program($1); };
+                ctx->ast_root = program($1); };
 
 class_list  : class                 /* single class */
                   { $$ = single_Classes($1);
-                  parse_results = $$; }
+                  ctx->parse_results = $$; }
             | class_list class      /* several classes */
                 { $$ = append_Classes($1,single_Classes($2)); 
-                  parse_results = $$; };
+                  ctx->parse_results = $$; };
 
 /* If no parent is specified, the class inherits from the Object class. */
 class:  CLASS TYPEID '{' feature_list '}' ';' 
-          { $$ = class_($2, idtable.add_string("Object"), $4, stringtable.add_string(curr_filename)); }
+          { $$ = class_($2, sym_Object, $4, ctx->filename_sym); }
       | CLASS TYPEID INHERITS TYPEID '{' feature_list '}' ';' 
-          { $$ = class_($2, $4, $6, stringtable.add_string(curr_filename)); }
+          { $$ = class_($2, $4, $6, ctx->filename_sym); }
       | CLASS error '{' feature_list '}' ';' 
           { yyerrok; yyclearin; $$ = NULL; }
       | CLASS error '{' error '}' ';' 
@@ -156,15 +183,24 @@ expression_list : expression
                   { $$ = append_Expressions($1, single_Expressions($3)); }
                 ;
 
-/* Any multiline expression */
-expression_block : expression ';'
-                { $$ = single_Expressions($1); }
-            |   expression ';' expression_block 
-                { $$ = append_Expressions(single_Expressions($1), $3); }
+/* Any multiline expression.  An error ends the block, keeping the
+   expressions before it.  The lists in this grammar are built by
+   left-recursive rules that append in place, so that the parser stack
+   stays the same size however long they are. */
+expression_block : expression_seq
+                { $$ = $1; }
+            |   expression_seq error ';'
+                { yyclearin; $$ = $1; }
             |   error ';'
                 { yyclearin; $$ = nil_Expressions(); }
             ;
 
+expression_seq : expression ';'
+                { $$ = single_Expressions($1); }
+            |   expression_seq expression ';'
+                { $1->push_back($2); $$ = $1; }
+            ;
+
 
 /* cases are STIL IN PROGRESS */
 case : OBJECTID ':' TYPEID DARROW expression ';'
@@ -176,27 +212,37 @@ case_list  :  case_list case { $$ = append_Cases($1, single_Cases($2)); }
        ;
 
 
-/* different types of let expression declarations */
-let_exp : OBJECTID ':' TYPEID ASSIGN expression IN expression 
-            %prec IN
-            { $$ = let($1, $3, $5, $7); }
-          | OBJECTID ':' TYPEID IN expression 
-            { $$ = let($1, $3, no_expr(), $5); }
-          | OBJECTID ':' TYPEID ASSIGN expression ',' let_exp
-            { $$ = let($1, $3, $5, $7); }
-          | OBJECTID ':' TYPEID ',' let_exp
-            { $$ = let($1, $3, no_expr(), $5); }
+/* different types of let expression declarations.  Each binding is a
+   let whose body is filled in once the body of the whole let is parsed:
+   a let with several bindings nests one let per binding. */
+let_binding : OBJECTID ':' TYPEID ASSIGN expression
+            { $$ = let($1, $3, $5, NULL); }
+          | OBJECTID ':' TYPEID
+            { $$ = let($1, $3, no_expr(), NULL); }
           ;
 
-/* Collection of formals, seperated by commas  */
-formal_list : formal
-              { $$ = single_Formals($1); }
-            | formal ','  formal_list 
-              { $$ = append_Formals(single_Formals($1), $3); }
+let_bindings : let_binding
+            { $$ = single_Expressions($1); }
+          | let_bindings ',' let_binding
+            { $1->push_back($3); $$ = $1; }
+          ;
+
+/* Collection of formals, seperated by commas; a trailing comma is
+   allowed */
+formal_list : formals
+              { $$ = $1; }
+            | formals ','
+              { $$ = $1; }
             |
               { $$ = nil_Formals(); }
             ;
 
+formals : formal
+              { $$ = single_Formals($1); }
+            | formals ',' formal
+              { $1->push_back($3); $$ = $1; }
+            ;
+
 /* These are like the params in methods */
 formal : OBJECTID ':' TYPEID 
           { $$ = formal($1, $3); }
@@ -209,15 +255,22 @@ feature_list:  features
                 {  yyerrok; $$ = nil_Features(); } 
               ;
 
-/* Features that are seperated by semicolons like attr and methods */
-features : feature ';' 
-              { $$ = single_Features($1); }
-          | feature ';' features
-              { $$ = append_Features(single_Features($1), $3); }
+/* Features that are seperated by semicolons like attr and methods.  An
+   error ends the list, keeping the features before it. */
+features : feature_seq
+              { $$ = $1; }
+          | feature_seq error ';'
+              { $$ = $1; }
           | error ';'
               { $$ = nil_Features();}
           ;
 
+feature_seq : feature ';'
+              { $$ = single_Features($1); }
+          | feature_seq feature ';'
+              { $1->push_back($2); $$ = $1; }
+          ;
+
 /* Each individual feature (the individual attr and methods in a class) */
 feature : OBJECTID ':' TYPEID ASSIGN expression
             { $$ = attr($1, $3, $5); }
@@ -233,9 +286,9 @@ expression : OBJECTID ASSIGN expression
 
               /* implied self dispatch */
             | OBJECTID '(' expression_list ')'
-              { $$ = dispatch(object(idtable.add_string("self")), $1, $3); }
+              { $$ = dispatch(object(sym_self), $1, $3); }
             | OBJECTID '(' ')'
-              { $$ = dispatch(object(idtable.add_string("self")), $1, nil_Expressions()); }
+              { $$ = dispatch(object(sym_self), $1, nil_Expressions()); }
 
 
             | expression '.' OBJECTID '(' expression_list ')'
@@ -259,8 +312,12 @@ expression : OBJECTID ASSIGN expression
             | WHILE expression LOOP expression POOL
               { $$ = loop($2, $4); }
             
-            | LET let_exp
-              { $$ = $2; }
+            | LET let_bindings IN expression
+              %prec IN
+              { $$ = $4;
+                for (auto b = $2->rbegin(); b != $2->rend(); ++b)
+                  $$ = static_cast<let_class *>(*b)->set_body($$);
+                delete $2; }
             | NEW TYPEID
               { $$ = new_($2); }
 
@@ -310,16 +367,33 @@ expression : OBJECTID ASSIGN expression
 %%
 
 /* This function is called automatically when Bison detects a parse error. Don't change this. */
-void yyerror(const char *s)
+void report_parse_error(int lineno, ParseContext *ctx, const char *s, int token, const YYSTYPE &value)
 {
-  extern int curr_lineno;
-
-  cerr << "\"" << curr_filename << "\", line " << curr_lineno << ": " \
+  cerr << "\"" << ctx->filename << "\", line " << lineno << ": " \
     << s << " at or near ";
-  print_cool_token(yychar);
+  print_cool_token(token, value);
   cerr << endl;
-  omerrs++;
+  ctx->omerrs++;
+
+  if(ctx->omerrs>50) {fprintf(stdout, "More than 50 errors\n"); exit(1);}
+}
 
-  if(omerrs>50) {fprintf(stdout, "More than 50 errors\n"); exit(1);}
+/* The lookahead's kind comes from the parser; the token and value are
+   the ones the parser was last handed, which ctx keeps (see
+   parse-context.h). */
+static int yyreport_syntax_error(const yypcontext_t *yyctx, ParseContext *ctx)
+{
+  YYSTYPE none = {};
+  if (yypcontext_token(yyctx) == YYSYMBOL_YYEMPTY || ctx->lookahead_value == NULL)
+    report_parse_error(*yypcontext_location(yyctx), ctx, "syntax error", YYEMPTY, none);
+  else
+    report_parse_error(*yypcontext_location(yyctx), ctx, "syntax error", ctx->lookahead, *ctx->lookahead_value);
+  return 0;
+}
+
+static void yyerror(YYLTYPE *loc, ParseContext *ctx, const char *s)
+{
+  YYSTYPE none = {};
+  report_parse_error(*loc, ctx, s, YYEMPTY, none);
 }
 
@@ -31,6 +31,12 @@ bool disable_reg_alloc;   // Don't do register allocation
 
 int cgen_optimize;                         // optimize switch for code generator
 char *out_filename;                        // file name for generated code
+char *snapshot_filename;                   // symbol table snapshot to map and update
+int stringtab_stats;                       // dump string table counters: 1 text, 2 YAML
+int report_times;                          // report input read, decode and parse times
+int token_ring_size;                       // decode tokens on a thread into a ring this big
+int intern_threads;                        // intern all symbols before parsing, with this many threads
+int push_tokens;                           // parse by pushing each token to the push parser
 Memmgr cgen_Memmgr = GC_NOGC;              // enable/disable garbage collection
 Memmgr_Test cgen_Memmgr_Test = GC_NORMAL;  // normal/test GC
 Memmgr_Debug cgen_Memmgr_Debug = GC_QUICK; // check heap frequently
@@ -51,8 +57,13 @@ void handle_flags(int argc, char *argv[]) {
   cgen_debug = 0;
   cgen_optimize = 0;
   disable_reg_alloc = 0;
+  stringtab_stats = 0;
+  report_times = 0;
+  token_ring_size = 0;
+  intern_threads = 0;
+  push_tokens = 0;
 
-  while ((c = getopt(argc, argv, "lpscvrOo:gtT")) != -1) {
+  while ((c = getopt(argc, argv, "lpscvrOo:gtTS:iIRP:B:u")) != -1) {
     switch (c) {
 #ifdef DEBUG
     case 'l': yy_flex_debug = 1; break;
@@ -84,6 +95,27 @@ void handle_flags(int argc, char *argv[]) {
     case 'O': // enable optimization
       cgen_optimize = 1;
       break;
+    case 'S': // map the string tables from a snapshot, and save them after the run
+      snapshot_filename = optarg;
+      break;
+    case 'i': // dump the string table counters after the run
+      stringtab_stats = 1;
+      break;
+    case 'I': // same, as YAML
+      stringtab_stats = 2;
+      break;
+    case 'R': // report where the time went
+      report_times = 1;
+      break;
+    case 'P': // decode the token stream on a second thread, ahead of the parser
+      token_ring_size = atoi(optarg);
+      break;
+    case 'B': // read the whole token stream and intern its symbols before parsing
+      intern_threads = atoi(optarg);
+      break;
+    case 'u': // push the tokens to the parser rather than let it pull them
+      push_tokens = 1;
+      break;
     case '?': unknownopt = 1; break;
     case ':': unknownopt = 1; break;
     }
@@ -92,9 +124,9 @@ void handle_flags(int argc, char *argv[]) {
   if (unknownopt) {
     cerr << "usage: " << argv[0] <<
 #ifdef DEBUG
-        " [-lvpscOgtTr -o outname] [input-files]\n";
+        " [-lvpscOgtTriIRu -o outname -S snapshot -P ringsize -B threads] [input-files]\n";
 #else
-        " [-OgtT -o outname] [input-files]\n";
+        " [-OgtTiIRu -o outname -S snapshot -P ringsize -B threads] [input-files]\n";
 #endif
     exit(1);
   }
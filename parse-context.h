@@ -0,0 +1,78 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+#ifndef _PARSE_CONTEXT_H_
+#define _PARSE_CONTEXT_H_
+
+#include "cool-tree.h"
+#include "cool-yaml.h"
+#include <stdio.h>
+#include <string>
+
+class TokenLexer;           // the lexer state of one parse; see parser-adapter.cc
+struct cool_yypstate;       // the state of a push parse; see cool-parse.h
+union YYSTYPE;              // a token value; see cool-parse.h
+
+//
+// A ParseContext holds everything one parse reads and changes: its input,
+// the lexer reading it, the file name the stream gives, the error count
+// and the resulting AST.  cool_yyparse and cool_yylex are passed the
+// context, so a process can run any number of parses, one after another
+// or on several threads at once, each with a context of its own.  The
+// symbol tables stay shared by every parse: the lexer interns one token
+// at a time under intern_lock, so concurrent parses take turns at the
+// tables, while converting a SymbolHandle takes no lock (see stringtab.h).
+//
+// The line number of each token is the parser's location (an int), and
+// the line number given to new tree nodes is node_lineno, which is
+// thread_local (see tree.cc) so that the AST constructors need no context.
+//
+// Instead of letting parse pull tokens from fin, a caller that gets its
+// tokens a few at a time (from a pipe or a socket, on an event loop) can
+// push them as they arrive.  Each push returns YYPUSH_MORE while the
+// parser wants more; after the last token, push_end returns what parse
+// would have: 0 if the input was accepted, 1 or 2 if the parse stopped.
+// A pushed token is interned as cool_yylex would; a token of kind
+// YYerror stands for an invalid one.  fin is not used, but filename must
+// be set before the first push.
+//
+class ParseContext {
+public:
+  FILE *fin;               // the token stream
+  std::string filename;    // its file name, as the stream gives it
+  Symbol filename_sym;     // filename in stringtable, for the classes
+  int omerrs;              // a count of lex and parse errors
+  Program *ast_root;       // the AST produced by the parse
+  Classes parse_results;   // the classes parsed so far
+  double read_seconds;     // time spent reading the stream, for -R
+  double decode_seconds;   // time spent parsing it with ryml, for -R
+  bool read_on_thread;     // the stream was read and decoded on a thread of
+                           // its own, not within the parse (-P without -B)
+  TokenLexer *lexer;       // created by the first cool_yylex
+  cool_yypstate *pusher;   // created by the first push
+  int push_lineno;         // the line of the last token pushed
+  int lookahead;           // the last token handed to the parser and its
+  const YYSTYPE *lookahead_value; // value (NULL once the parser returns);
+                           // parse errors are reported at or near them
+
+  ParseContext(FILE *in);
+  ~ParseContext();
+  ParseContext(const ParseContext &) = delete;
+  ParseContext &operator=(const ParseContext &) = delete;
+
+  // run cool_yyparse on the stream; returns its result
+  int parse();
+
+  // push the next token or tokens, or the end of the input
+  int push(const token &tok);
+  int push(const token *toks, size_t n);
+  int push_end();
+
+private:
+  int push_value(int kind, const YYSTYPE &value, int lineno);
+};
+
+#endif
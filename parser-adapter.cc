@@ -4,44 +4,629 @@
 #include "cool-yaml.h"
 #include "stringtab.h"
 #include "utilities.h"
-#define yylval  cool_yylval
-#define YYEOF   0
-#define YYerror 256
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
-extern int curr_lineno;
-extern FILE *fin;
-extern char *curr_filename;
+extern int token_ring_size;
+extern int intern_threads;
+extern int push_tokens;
 
 int yy_flex_debug;
 
-bool node_to_token(ryml::ConstNodeRef node, token &tok, const size_t pos) {
-  if (!c4::atou<unsigned int>(node["lineno"].val(), &tok.lineno)) {
-    cerr << "Invalid lineno at token #" << pos << "; expected an unsigned number, got "
-         << node["lineno"].val() << endl;
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//
+// A TokenReader decodes the token stream a window at a time, so that
+// memory stays bounded however long the stream is.  The stream is
+//
+//   name: <file name>
+//   tokens:
+//     - kind: ...
+//       lineno: ...
+//
+// The header, up to the tokens: line, is parsed on its own.  After that,
+// every item of the tokens sequence starts a line with the same "- ", so
+// the reader cuts the window just before the last item start it holds,
+// parses the complete items before the cut as one batch, and hands out
+// their nodes in order.  The batch tree and the ryml parser are reused
+// from one window to the next.  An item that does not fit in the window
+// makes the window grow to hold it.  A stream laid out any other way (its
+// name after its tokens, say, or no item on the first line after tokens:
+// that is not blank or a comment) is parsed whole.
+//
+// A regular file is mapped privately and parsed in place; the pages
+// behind each finished window are dropped.  Anything else (a pipe, a
+// terminal) is read into a window that is refilled as it is consumed.
+//
+// A stream that starts with BINARY_TOKEN_MAGIC is in the binary format of
+// cool-yaml.h instead.  It is checked once when it is opened, and each
+// token is then read straight from its fixed-width record.
+//
+// The reader touches no parser state: the line number of each token is
+// left in the token, and the diagnostics for invalid tokens go to err,
+// so that a TokenRing can run it on a thread of its own.
+//
+bool node_to_token(ryml::ConstNodeRef node, token &tok, const size_t pos, ostream &err);
+
+class TokenReader {
+  static const size_t WINDOW = 256 * 1024;
+
+  FILE *f;
+  char *buf;              // the mapped input, or the window
+  size_t size;            // the bytes of buf holding input
+  size_t cap;             // the size of the window; 0 if buf is mapped
+  size_t begin;           // the first byte not yet parsed
+  bool eof;               // all of the input is in buf
+  std::string item_start; // a line break and the "- " that starts an item
+  ryml::Parser parser;
+  ryml::Tree batch;
+  size_t cursor; // the next token node in batch, or ryml::NONE
+
+  const binary_token *records; // the records of a binary stream, or NULL
+  const char *strings;         // its string section
+  size_t count;                // its number of tokens
+
+  ostream *err; // where invalid tokens are reported
+
+  bool fill();
+  size_t header_end();
+  size_t first_item(size_t at);
+  bool parse_whole();
+  bool open_binary(string &name);
+  bool next_node(ryml::ConstNodeRef &node);
+
+public:
+  double read_seconds;   // time spent reading the stream, reported by -R
+  double decode_seconds; // time spent parsing it with ryml
+
+  TokenReader()
+      : f(NULL), buf(NULL), size(0), cap(0), begin(0), eof(false), cursor(ryml::NONE), records(NULL),
+        strings(NULL), count(0), err(&cerr), read_seconds(0), decode_seconds(0) {}
+  bool open(FILE *in, string &name);
+  // 1 if tok holds the next token, 0 at the end of the stream, and -1
+  // after an error message if the next token is invalid.  tok.lineno is
+  // left alone if the token has no valid line number.
+  int next(token &tok, size_t pos);
+  void report_to(ostream &s) { err = &s; }
+};
+
+//
+// fill reads more input into the window, after moving the unparsed bytes
+// to its front, and doubles the window if they already fill it.  It
+// returns false once there is no more input.
+//
+bool TokenReader::fill() {
+  if (eof) return false;
+  auto start = std::chrono::steady_clock::now();
+  if (begin > 0) {
+    memmove(buf, buf + begin, size - begin);
+    size -= begin;
+    begin = 0;
+  }
+  if (size == cap) buf = (char *)realloc(buf, cap = cap ? cap * 2 : WINDOW);
+  if (buf == NULL) {
+    cerr << "Out of memory reading the input." << endl;
+    exit(1);
+  }
+  size_t n = fread(buf + size, 1, cap - size, f);
+  size += n;
+  eof = n == 0;
+  read_seconds += seconds_since(start);
+  return n > 0;
+}
+
+//
+// header_end returns the end of the tokens: line, reading more input as
+// needed, or the end of the input if there is no such line.
+//
+size_t TokenReader::header_end() {
+  for (;;) {
+    std::string_view text(buf, size);
+    size_t at = text.substr(0, 7) == "tokens:" ? 0 : text.find("\ntokens:");
+    size_t end = at == std::string_view::npos ? at : text.find('\n', at + 1);
+    if (end != std::string_view::npos) return end + 1;
+    if (!fill()) return size;
+  }
+}
+
+//
+// first_item returns the start of the first line from at on that is
+// neither blank nor a comment, reading more input as needed, and sets
+// item_start if that line starts an item.  Called before begin moves, so
+// that fill keeps all of the input in buf.
+//
+size_t TokenReader::first_item(size_t at) {
+  for (;;) {
+    size_t end = at;
+    while (end < size && buf[end] != '\n')
+      end++;
+    if (end == size && fill()) continue;
+    size_t indent = at;
+    while (indent < end && buf[indent] == ' ')
+      indent++;
+    size_t text = indent;
+    while (text < end && (buf[text] == '\t' || buf[text] == '\r'))
+      text++;
+    if (text < end && buf[text] != '#') {
+      if (indent + 1 < end && buf[indent] == '-' && buf[indent + 1] == ' ')
+        item_start = "\n" + string(buf + at, indent - at) + "- ";
+      return at;
+    }
+    if (end == size) return size;
+    at = end + 1;
+  }
+}
+
+//
+// parse_whole reads the rest of the input and parses all of it, as the
+// lexer did before the reader decoded the stream a window at a time.
+//
+bool TokenReader::parse_whole() {
+  while (fill())
+    ;
+  item_start.clear();
+  auto start = std::chrono::steady_clock::now();
+  batch.clear();
+  batch.clear_arena();
+  parser.parse_in_place({}, c4::substr(buf, size), &batch);
+  decode_seconds += seconds_since(start);
+  begin = size;
+  cursor = ryml::NONE;
+  if (!batch.is_map(batch.root_id())) return false;
+  size_t tokens = batch.find_child(batch.root_id(), "tokens");
+  if (tokens != ryml::NONE && batch.is_seq(tokens)) cursor = batch.first_child(tokens);
+  return true;
+}
+
+//
+// open reads the header and the file name in it.  It returns false, after
+// an error message, if the input does not look like a token stream.
+//
+bool TokenReader::open(FILE *in, string &name) {
+  f = in;
+  int fd = fileno(f);
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0) {
+    void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      buf = (char *)p;
+      size = st.st_size;
+      eof = true;
+    }
+  }
+  if (buf == NULL) fill();
+  if (size >= 8 && memcmp(buf, BINARY_TOKEN_MAGIC, 8) == 0) return open_binary(name);
+
+  // the header is parsed on its own, from a copy so that buf is left as
+  // it was should the stream have to be parsed whole after all; a stream
+  // without a tokens: line is all header
+  size_t header = header_end();
+  auto start = std::chrono::steady_clock::now();
+  batch.clear();
+  batch.clear_arena();
+  parser.parse_in_arena({}, c4::csubstr(buf, header), &batch);
+  decode_seconds += seconds_since(start);
+  bool ok = batch.is_map(batch.root_id());
+  if (ok) {
+    size_t tokens = batch.find_child(batch.root_id(), "tokens");
+    if (tokens != ryml::NONE && batch.is_seq(tokens)) cursor = batch.first_child(tokens);
+    // the indentation of the first item gives the start of every item
+    size_t items = first_item(header);
+    if (batch.find_child(batch.root_id(), "name") == ryml::NONE || (cursor == ryml::NONE && item_start.empty()))
+      ok = parse_whole();
+    else
+      begin = items;
+  }
+  size_t name_id = ok ? batch.find_child(batch.root_id(), "name") : ryml::NONE;
+  if (name_id == ryml::NONE || !batch.has_val(name_id)) {
+    cerr << "Failed to parse the input; expected a YAML token stream." << endl;
+    return false;
+  }
+  name = std::string(batch.val(name_id).str, batch.val(name_id).len);
+  return true;
+}
+
+//
+// binary_kinds tells which kinds name a token, so that next checks the
+// kind of a record with one load.  Every token number is below YYUNDEF.
+//
+static const std::array<bool, YYUNDEF> binary_kinds = [] {
+  std::array<bool, YYUNDEF> known{};
+  for (int kind = 0; kind < YYUNDEF; kind++)
+    known[kind] = strcmp(cool_token_to_string(kind), "<Invalid Token>") != 0;
+  return known;
+}();
+
+//
+// A binary stream is read whole.  Its header and the bounds of every
+// symbol are checked here, so that next need not check them.  A record
+// of an unknown kind is reported by next, when it is reached, like an
+// invalid token of a YAML stream.
+//
+bool TokenReader::open_binary(string &name) {
+  while (fill())
+    ;
+  auto start = std::chrono::steady_clock::now();
+  binary_token_header header;
+  bool ok = size >= sizeof(header);
+  if (ok) {
+    memcpy(&header, buf, sizeof(header));
+    uint64_t strings_at = sizeof(header) + (uint64_t)header.count * sizeof(binary_token);
+    ok = strings_at + header.strings_size <= size && header.name_len <= header.strings_size;
+    records = (const binary_token *)(buf + sizeof(header));
+    strings = buf + strings_at;
+    count = header.count;
+  }
+  for (size_t i = 0; ok && i < count; i++)
+    ok = records[i].kind == BOOL_CONST || (uint64_t)records[i].offset + records[i].length <= header.strings_size;
+  decode_seconds += seconds_since(start);
+  if (!ok) {
+    cerr << "Failed to parse the input; the binary token stream is truncated or corrupt." << endl;
     return false;
   }
-  curr_lineno = tok.lineno;
+  name = std::string(strings, header.name_len);
+  return true;
+}
+
+int TokenReader::next(token &tok, size_t pos) {
+  if (records == NULL) {
+    ryml::ConstNodeRef node;
+    if (!next_node(node)) return 0;
+    return node_to_token(node, tok, pos, *err) ? 1 : -1;
+  }
 
-  std::string str_kind = std::string(node["kind"].val().str, node["kind"].val().len);
-  auto c = string_to_cool_token.find(str_kind);
-  if (c == string_to_cool_token.end()) {
-    cerr << "Invalid kind at token #" << pos << "; expected a kind, got " << str_kind << endl;
+  if (pos >= count) return 0;
+  const binary_token &rec = records[pos];
+  tok.lineno = rec.lineno;
+  if (rec.kind < 0 || rec.kind >= YYUNDEF || !binary_kinds[rec.kind]) {
+    *err << "Invalid kind at token #" << pos << "; expected a kind, got " << rec.kind << endl;
+    return -1;
+  }
+  tok.kind = rec.kind;
+  if (rec.kind == BOOL_CONST)
+    tok.boolean = rec.offset != 0;
+  else
+    tok.symbol = std::string_view(strings + rec.offset, rec.length);
+  return 1;
+}
+
+//
+// next_node sets node to the next token, parsing another window when the
+// batch runs out.  It returns false at the end of the stream.
+//
+bool TokenReader::next_node(ryml::ConstNodeRef &node) {
+  while (cursor == ryml::NONE) {
+    if (item_start.empty()) return false;
+    if (cap == 0 && begin > 0) {
+      // drop the pages of the mapping that have been parsed
+      size_t page = sysconf(_SC_PAGESIZE);
+      madvise(buf, begin / page * page, MADV_DONTNEED);
+    }
+
+    // cut before the last item that starts in the window, or at the end
+    size_t cut;
+    for (;;) {
+      size_t window = cap ? size : std::min(size, begin + WINDOW);
+      std::string_view text(buf + begin, window - begin);
+      cut = text.rfind(item_start);
+      if (cut != std::string_view::npos && cut > 0) {
+        cut += begin + 1;
+        break;
+      }
+      if (window == size && eof) {
+        cut = size;
+        break;
+      }
+      if (cap == 0) {
+        cut = text.find(item_start, 1);
+        cut = cut == std::string_view::npos ? size : begin + cut + 1;
+        break;
+      }
+      fill();
+    }
+    if (cut == begin) return false;
+
+    auto start = std::chrono::steady_clock::now();
+    batch.clear();
+    batch.clear_arena();
+    parser.parse_in_place({}, c4::substr(buf + begin, cut - begin), &batch);
+    decode_seconds += seconds_since(start);
+    begin = cut;
+    if (batch.is_seq(batch.root_id())) cursor = batch.first_child(batch.root_id());
+  }
+  node = ryml::ConstNodeRef(&batch, cursor);
+  cursor = batch.next_sibling(cursor);
+  return true;
+}
+
+//
+// The lexer writes the fields of a token in one order: kind, lineno, and
+// then symbol or boolean if the token has one (see build_yaml_tree).
+// canonical_fields reads the children of such a token by position,
+// checking each key with a single compare.  It returns false for a token
+// with its fields in any other order, which is then read by name.
+//
+static bool canonical_fields(const ryml::Tree &t, size_t node, size_t &kind, size_t &lineno, size_t &symbol,
+                             size_t &boolean) {
+  kind = t.first_child(node);
+  if (kind == ryml::NONE || t.key(kind) != "kind") return false;
+  lineno = t.next_sibling(kind);
+  if (lineno == ryml::NONE || t.key(lineno) != "lineno") return false;
+  size_t extra = t.next_sibling(lineno);
+  symbol = boolean = ryml::NONE;
+  if (extra == ryml::NONE) return true;
+  if (t.next_sibling(extra) != ryml::NONE) return false;
+  if (t.key(extra) == "symbol")
+    symbol = extra;
+  else if (t.key(extra) == "boolean")
+    boolean = extra;
+  else
     return false;
+  return true;
+}
+
+bool node_to_token(ryml::ConstNodeRef node, token &tok, const size_t pos, ostream &err) {
+  const ryml::Tree &t = *node.tree();
+  size_t kind_id, lineno_id, symbol, boolean;
+  if (!canonical_fields(t, node.id(), kind_id, lineno_id, symbol, boolean)) {
+    kind_id = node["kind"].id();
+    lineno_id = node["lineno"].id();
+    symbol = t.find_child(node.id(), "symbol");
+    boolean = t.find_child(node.id(), "boolean");
   }
-  tok.kind = c->second;
-  if (node.has_child("symbol")) {
-    tok.symbol = std::string(node["symbol"].val().str, node["symbol"].val().len);
+
+  unsigned int lineno;
+  if (!c4::atou<unsigned int>(t.val(lineno_id), &lineno)) {
+    err << "Invalid lineno at token #" << pos << "; expected an unsigned number, got " << t.val(lineno_id)
+        << endl;
+    return false;
   }
-  if (node.has_child("boolean")) {
-    tok.boolean = node["boolean"].val() == "true";
+  tok.lineno = lineno;
+
+  c4::csubstr kind = t.val(kind_id);
+  tok.kind = cool_token_from_string(kind);
+  if (tok.kind < 0) {
+    err << "Invalid kind at token #" << pos << "; expected a kind, got " << kind << endl;
+    return false;
+  }
+  if (symbol != ryml::NONE) {
+    tok.symbol = std::string_view(t.val(symbol).str, t.val(symbol).len);
+  }
+  if (boolean != ryml::NONE) {
+    tok.boolean = t.val(boolean) == "true";
   }
   return true;
 }
 
-void populate_tables_from_token(const token tok) {
+//
+// A TokenRing runs a TokenReader on a producer thread, so that decoding
+// the stream overlaps with parsing it (the -P flag).  The producer fills
+// a single-producer/single-consumer ring of slots; cool_yylex takes them
+// in order.  head and tail count the slots taken and filled so far, and
+// each is written by one side only; a slot is handed over by the release
+// store of tail and handed back by that of head.  A side that finds the
+// ring empty (or full) yields until the other catches up.
+//
+// A token's symbol points into the reader's window, which the producer
+// moves on, so each slot keeps a copy of it.  The diagnostic for an
+// invalid token is kept in its slot as well and printed when the token
+// is taken, so that it comes out among the parser's own messages just
+// where it would without the ring.  The producer stops after the end of
+// the stream, whose slot then stays at the head of the ring, or when the
+// ring is deleted, which a parse that stops early does before the end.
+//
+class TokenRing {
+  struct slot {
+    token tok;
+    int result;         // what TokenReader::next returned for tok
+    std::string symbol; // the bytes tok.symbol points to
+    std::string error;  // the diagnostic printed for tok, if any
+  };
+
+  TokenReader &reader;
+  std::vector<slot> slots; // a power of two of them
+  size_t mask;
+  alignas(64) std::atomic<size_t> head; // written by the consumer
+  alignas(64) std::atomic<size_t> tail; // written by the producer
+  std::atomic<bool> stop;               // set to stop the producer early
+  std::thread producer;
+
+  void produce(unsigned int lineno);
+
+public:
+  TokenRing(TokenReader &r, size_t size, unsigned int lineno);
+  ~TokenRing();
+  // the next token; it stays valid until pop
+  const slot &front();
+  void pop();
+};
+
+TokenRing::TokenRing(TokenReader &r, size_t size, unsigned int lineno)
+    : reader(r), head(0), tail(0), stop(false) {
+  size_t n = 2;
+  while (n < size)
+    n *= 2;
+  slots.resize(n);
+  mask = n - 1;
+  producer = std::thread(&TokenRing::produce, this, lineno);
+}
+
+TokenRing::~TokenRing() {
+  stop.store(true, std::memory_order_relaxed);
+  producer.join();
+}
+
+void TokenRing::produce(unsigned int lineno) {
+  std::ostringstream errors;
+  reader.report_to(errors);
+  for (size_t pos = 0;; pos++) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    while (t - head.load(std::memory_order_acquire) == slots.size()) {
+      if (stop.load(std::memory_order_relaxed)) return;
+      std::this_thread::yield();
+    }
+    slot &s = slots[t & mask];
+    s.tok.lineno = lineno; // kept by a token without a valid line number
+    s.result = reader.next(s.tok, pos);
+    lineno = s.tok.lineno;
+    if (s.result > 0 && s.tok.kind != BOOL_CONST) {
+      s.symbol.assign(s.tok.symbol);
+      s.tok.symbol = s.symbol;
+    }
+    s.error = errors.str();
+    errors.str("");
+    tail.store(t + 1, std::memory_order_release);
+    if (s.result == 0) return;
+  }
+}
+
+const TokenRing::slot &TokenRing::front() {
+  size_t h = head.load(std::memory_order_relaxed);
+  while (tail.load(std::memory_order_acquire) == h)
+    std::this_thread::yield();
+  return slots[h & mask];
+}
+
+void TokenRing::pop() {
+  head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+//
+// InternedTokens reads the whole token stream before parsing starts and
+// interns every symbol in it at once (the -B flag), so that cool_yylex
+// only has to hand out the Symbol stored with each token.  The symbols
+// are copied out of the reader's window as they are read.  Then the
+// hashes of the identifiers and of the strings without escapes, which
+// are most of the symbols, are computed, split over threads if asked
+// to.  Then every symbol is interned, in token order, so that the
+// entries get the indices they would get one token at a time.  The
+// tables themselves drop the duplicates.
+//
+// Anything with a diagnostic is left to parse time, so that messages
+// still come out in order.  That covers invalid tokens, whose messages
+// are kept with them, and strings with malformed escapes, which are
+// interned by populate_tables_from_token when they are reached.  Ints
+// out of range are also checked when they are reached.
+//
+class InternedTokens {
+  struct record {
+    token tok;
+    int result;    // what TokenReader::next returned for tok
+    Symbol symbol; // the interned tok.symbol, or NULL
+    size_t hash;   // hash_string(tok.symbol), if add_hashed will use it
+    int error;     // the diagnostic printed for tok in errors, or -1
+  };
+
+  std::vector<record> records;
+  std::vector<std::string> errors;
+  StringArena symbols; // the bytes every tok.symbol points to
+  size_t next;
+
+  void hash(size_t from, size_t to);
+
+public:
+  InternedTokens(TokenReader &reader, int threads, unsigned int lineno);
+  // the next token; it stays valid until pop
+  const record &front() const { return records[next]; }
+  void pop() { next++; }
+  const std::string &error(const record &r) const { return errors[r.error]; }
+};
+
+static bool hashed_kind(const token &tok) {
+  return tok.kind == TYPEID || tok.kind == OBJECTID ||
+         (tok.kind == STR_CONST && tok.symbol.find('\\') == std::string_view::npos);
+}
+
+InternedTokens::InternedTokens(TokenReader &reader, int threads, unsigned int lineno) : next(0) {
+  std::ostringstream err;
+  reader.report_to(err);
+  record r;
+  r.tok.lineno = lineno;
+  for (size_t pos = 0;; pos++) {
+    r.result = reader.next(r.tok, pos);
+    r.symbol = NULL;
+    r.error = -1;
+    if (err.tellp() > 0) {
+      r.error = errors.size();
+      errors.push_back(err.str());
+      err.str("");
+    }
+    if (r.result > 0 && (r.tok.kind == TYPEID || r.tok.kind == OBJECTID || r.tok.kind == INT_CONST ||
+                         r.tok.kind == STR_CONST))
+      r.tok.symbol = symbols.copy(r.tok.symbol);
+    records.push_back(r);
+    if (r.result == 0) break;
+  }
+  reader.report_to(cerr);
+
+  std::vector<std::thread> helpers;
+  size_t chunk = records.size() / std::max(threads, 1) + 1;
+  for (size_t from = chunk; from < records.size(); from += chunk)
+    helpers.emplace_back(&InternedTokens::hash, this, from, std::min(from + chunk, records.size()));
+  hash(0, std::min(chunk, records.size()));
+  for (std::thread &t : helpers)
+    t.join();
+
+  std::lock_guard<std::mutex> hold(intern_lock);
+  std::string unescaped;
+  for (record &r : records) {
+    if (r.result <= 0) continue;
+    switch (r.tok.kind) {
+    case TYPEID:
+    case OBJECTID: r.symbol = idtable.add_hashed(r.tok.symbol, r.hash); break;
+    case INT_CONST: r.symbol = inttable.add_string(r.tok.symbol); break;
+    case STR_CONST:
+      if (hashed_kind(r.tok))
+        r.symbol = stringtable.add_hashed(r.tok.symbol, r.hash);
+      else if (get_unescaped_string(r.tok.symbol, unescaped, false))
+        r.symbol = stringtable.add_string(unescaped);
+      break;
+    }
+  }
+}
+
+void InternedTokens::hash(size_t from, size_t to) {
+  for (size_t i = from; i < to; i++)
+    if (records[i].result > 0 && hashed_kind(records[i].tok)) records[i].hash = hash_string(records[i].tok.symbol);
+}
+
+//
+// COOL Ints are 32-bit.  A literal that does not fit is still passed to
+// the parser, so that parsing goes on, but it halts the compilation.
+//
+static void check_int_range(IntEntry *e, ParseContext *ctx, int lineno) {
+  if (e->get_value() > INT32_MAX) {
+    cerr << "\"" << ctx->filename << "\", line " << lineno << ": integer constant " << e->get_string()
+         << " is out of range for Int" << endl;
+    ctx->omerrs++;
+  }
+}
+
+void populate_tables_from_token(const token &tok, YYSTYPE &yylval, ParseContext *ctx) {
+  std::lock_guard<std::mutex> hold(intern_lock);
   switch (tok.kind) {
-  case INT_CONST: yylval.symbol = inttable.add_string(tok.symbol); break;
-  case STR_CONST: yylval.symbol = stringtable.add_string(get_unescaped_string(tok.symbol)); break;
+  case INT_CONST: {
+    IntEntry *e = inttable.add_string(tok.symbol);
+    check_int_range(e, ctx, tok.lineno);
+    yylval.symbol = e;
+    break;
+  }
+  case STR_CONST: {
+    static std::string unescaped; // reused by every string constant, under intern_lock
+    get_unescaped_string(tok.symbol, unescaped);
+    yylval.symbol = stringtable.add_string(unescaped);
+    break;
+  }
   case TYPEID:
   case OBJECTID: yylval.symbol = idtable.add_string(tok.symbol); break;
   case BOOL_CONST: yylval.boolean = tok.boolean; break;
@@ -49,45 +634,173 @@ void populate_tables_from_token(const token tok) {
   }
 }
 
-int cool_yylex(void) {
-  // These variables are only used internally within this function's scope
-  static string filename;
-  static string content;
-  static int init = 0;
-  static size_t pos = 0;
-  static ryml::ConstNodeRef cur_token;
-  static ryml::Tree token_root;
+//
+// The lexer state of one parse: the reader, the position in the stream,
+// and the ring or the interned tokens that -P or -B put in front of it.
+// The stream is opened by the first lex.
+//
+class TokenLexer {
+  TokenReader reader;
+  bool opened;
+  size_t pos;
+  TokenRing *ring;
+  InternedTokens *tokens;
+  bool threaded; // the reader ran on the ring's producer thread
 
-  if (init == 0) {
-    char buf[512];
-    int result;
-    while ((result = fread(buf, 1, sizeof(buf), fin)) > 0) {
-      content.append(buf, result);
+public:
+  TokenLexer() : opened(false), pos(0), ring(NULL), tokens(NULL), threaded(false) {}
+  ~TokenLexer() { finish(); }
+  // the next token, with its value in yylval and its line in lineno
+  int lex(YYSTYPE &yylval, int &lineno, ParseContext *ctx);
+  // stop reading: the producer thread is gone and the times are final
+  void finish();
+  double read_seconds() const { return reader.read_seconds; }
+  double decode_seconds() const { return reader.decode_seconds; }
+  bool read_on_thread() const { return threaded; }
+};
+
+int TokenLexer::lex(YYSTYPE &yylval, int &lineno, ParseContext *ctx) {
+  if (!opened) {
+    opened = true;
+    if (!reader.open(ctx->fin, ctx->filename)) return YYEOF;
+    {
+      std::lock_guard<std::mutex> hold(intern_lock);
+      ctx->filename_sym = stringtable.add_string(ctx->filename);
     }
-    token_root = ryml::parse_in_place(c4::to_substr(content));
-    if (!token_root.is_map(token_root.root_id())) {
-      cerr << "Failed to parse the input; expected a YAML token stream." << endl;
-      return YYEOF;
+    if (intern_threads > 0)
+      tokens = new InternedTokens(reader, intern_threads, lineno);
+    else if (token_ring_size > 0) {
+      ring = new TokenRing(reader, token_ring_size, lineno);
+      threaded = true;
     }
-    filename = std::string(token_root["name"].val().str, token_root["name"].val().len);
-    curr_filename = &filename[0];
-    init = 1;
   }
 
-  // Reached the end of the token stream
-  if (pos == token_root["tokens"].num_children()) {
-    return YYEOF;
+  if (tokens != NULL) {
+    const auto &r = tokens->front();
+    if (r.error >= 0) cerr << tokens->error(r);
+    if (r.result == 0) return YYEOF; // the last record, never popped
+    lineno = r.tok.lineno;
+    tokens->pop();
+    if (r.result < 0) return YYerror;
+    if (r.symbol == NULL) {
+      populate_tables_from_token(r.tok, yylval, ctx);
+    } else {
+      yylval.symbol = r.symbol;
+      if (r.tok.kind == INT_CONST) check_int_range((IntEntry *)r.symbol, ctx, lineno);
+    }
+    return r.tok.kind;
   }
 
-  // Try to convert the node to a token object
-  token tok;
-  if (!node_to_token(token_root["tokens"][pos], tok, pos)) {
-    pos++;
-    return YYerror;
+  if (ring != NULL) {
+    const auto &s = ring->front();
+    if (!s.error.empty()) cerr << s.error;
+    if (s.result == 0) return YYEOF; // stays at the head of the ring
+    lineno = s.tok.lineno;
+    if (s.result < 0) {
+      ring->pop();
+      return YYerror;
+    }
+    populate_tables_from_token(s.tok, yylval, ctx);
+    int kind = s.tok.kind;
+    ring->pop();
+    return kind;
   }
-  pos++;
+
+  // Try to read the next token
+  token tok;
+  tok.lineno = lineno;
+  int result = reader.next(tok, pos++);
+  if (result == 0) return YYEOF; // reached the end of the token stream
+  lineno = tok.lineno;
+  if (result < 0) return YYerror;
   // Fill up the tables so that the parser can access them
-  populate_tables_from_token(tok);
+  populate_tables_from_token(tok, yylval, ctx);
 
   return tok.kind;
 }
+
+void TokenLexer::finish() {
+  delete ring;
+  delete tokens;
+  ring = NULL;
+  tokens = NULL;
+}
+
+int cool_yylex(YYSTYPE *yylval, int *lineno, ParseContext *ctx) {
+  if (ctx->lexer == NULL) ctx->lexer = new TokenLexer;
+  ctx->lookahead = ctx->lexer->lex(*yylval, *lineno, ctx);
+  ctx->lookahead_value = yylval;
+  return ctx->lookahead;
+}
+
+ParseContext::ParseContext(FILE *in)
+    : fin(in), filename("<stdin>"), filename_sym(NULL), omerrs(0), ast_root(NULL), parse_results(NULL),
+      read_seconds(0), decode_seconds(0), read_on_thread(false), lexer(NULL), pusher(NULL), push_lineno(0),
+      lookahead(YYEMPTY), lookahead_value(NULL) {}
+
+ParseContext::~ParseContext() {
+  delete lexer;
+  if (pusher != NULL) cool_yypstate_delete(pusher);
+}
+
+//
+// With -u, parse reads the stream itself and pushes each token, which
+// takes the push parser through the same inputs as the pull parser.
+//
+int ParseContext::parse() {
+  int result;
+  if (push_tokens) {
+    if (lexer == NULL) lexer = new TokenLexer;
+    YYSTYPE value;
+    int lineno = 0;
+    do {
+      int kind = lexer->lex(value, lineno, this);
+      result = push_value(kind, value, lineno);
+    } while (result == YYPUSH_MORE);
+  } else {
+    result = cool_yyparse(this);
+    lookahead_value = NULL; // it was cool_yyparse's own
+  }
+  if (lexer != NULL) {
+    lexer->finish();
+    read_seconds = lexer->read_seconds();
+    decode_seconds = lexer->decode_seconds();
+    read_on_thread = lexer->read_on_thread();
+  }
+  return result;
+}
+
+int ParseContext::push_value(int kind, const YYSTYPE &value, int lineno) {
+  if (pusher == NULL) {
+    pusher = cool_yypstate_new();
+    if (pusher == NULL) return 2; // out of memory, as cool_yyparse reports it
+  }
+  lookahead = kind;
+  lookahead_value = &value;
+  int result = cool_yypush_parse(pusher, kind, &value, &lineno, this);
+  lookahead_value = NULL; // value is the caller's, gone once push returns
+  return result;
+}
+
+int ParseContext::push(const token &tok) {
+  if (filename_sym == NULL) {
+    std::lock_guard<std::mutex> hold(intern_lock);
+    filename_sym = stringtable.add_string(filename);
+  }
+  YYSTYPE value = {};
+  if (tok.kind != YYerror) populate_tables_from_token(tok, value, this);
+  push_lineno = tok.lineno;
+  return push_value(tok.kind, value, push_lineno);
+}
+
+int ParseContext::push(const token *toks, size_t n) {
+  int result = YYPUSH_MORE;
+  for (size_t i = 0; i < n && result == YYPUSH_MORE; i++)
+    result = push(toks[i]);
+  return result;
+}
+
+int ParseContext::push_end() {
+  YYSTYPE value = {};
+  return push_value(YYEOF, value, push_lineno);
+}
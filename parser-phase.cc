@@ -19,30 +19,36 @@
 #include "cool-parse.h"
 #include "cool-tree.h"
 #include "cool-tree.handcode.h"
+#include <chrono>
 #include <stdio.h>  // for Linux system
 #include <unistd.h> // for getopt
 
-//
-// These globals keep everything working.
-//
-FILE *fin = stdin;            // we read from this file
-extern Classes parse_results; // list of classes; used for multiple files
-extern Program *ast_root;     // the AST produced by the parse
-
-const char *curr_filename = "<stdin>";
-
-extern int omerrs; // a count of lex and parse errors
-
-extern int cool_yyparse();
+extern char *snapshot_filename;
+extern int stringtab_stats;
+extern int report_times;
 void handle_flags(int argc, char *argv[]);
 
 int main(int argc, char *argv[]) {
   handle_flags(argc, argv);
-  cool_yyparse();
-  if (omerrs != 0) {
+  if (snapshot_filename) map_string_tables(snapshot_filename);
+  ParseContext ctx(stdin);
+  auto start = std::chrono::steady_clock::now();
+  ctx.parse();
+  double parse_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (report_times) {
+    // the parse includes the lexer's reading and decoding, unless they
+    // ran on the lexer's own thread; report them apart
+    if (!ctx.read_on_thread) parse_seconds -= ctx.read_seconds + ctx.decode_seconds;
+    cerr << std::fixed << std::setprecision(3) << "read:   " << ctx.read_seconds * 1000 << " ms\n"
+         << "decode: " << ctx.decode_seconds * 1000 << " ms\n"
+         << "parse:  " << parse_seconds * 1000 << " ms\n";
+  }
+  if (stringtab_stats) dump_string_table_stats(cerr, stringtab_stats == 2);
+  if (ctx.omerrs != 0) {
     cerr << "Compilation halted due to lex and parse errors\n";
     exit(1);
   }
-  emit_yaml(std::cout, ast_root);
+  emit_yaml(std::cout, ctx.ast_root);
+  if (snapshot_filename) write_string_tables(snapshot_filename);
   return 0;
 }
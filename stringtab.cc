@@ -7,6 +7,12 @@
 #include "stringtab.h"
 #include "stringtab_functions.h"
 #include <assert.h>
+#include <charconv>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 //
 // Explicit template instantiations.
@@ -15,15 +21,73 @@
 template class StringTable<IdEntry>;
 template class StringTable<StringEntry>;
 template class StringTable<IntEntry>;
+template class ConcurrentStringTable<IdEntry>;
+template class ConcurrentStringTable<StringEntry>;
+template class ConcurrentStringTable<IntEntry>;
 
-Entry::Entry(std::string s, int l, int i) : str(s), len(l), index(i) {}
+size_t hash_string(std::string_view s) {
+  return std::hash<std::string_view>{}(s);
+}
+
+//
+// Strings larger than a block get a block of their own, so the rest of
+// the current block is not wasted.
+//
+#define ARENA_BLOCK_SIZE 65536
+
+StringArena::~StringArena() {
+  for (char *block : blocks)
+    delete[] block;
+}
+
+std::string_view StringArena::copy(std::string_view s) {
+  size_t need = s.length() + 1;
+  char *p;
+  if (need > ARENA_BLOCK_SIZE) {
+    p = new char[need];
+    blocks.push_back(p);
+  } else {
+    if (need > left) {
+      next = new char[ARENA_BLOCK_SIZE];
+      left = ARENA_BLOCK_SIZE;
+      blocks.push_back(next);
+    }
+    p = next;
+    next += need;
+    left -= need;
+  }
+  memcpy(p, s.data(), s.length());
+  p[s.length()] = '\0';
+  return std::string_view(p, s.length());
+}
+
+void StringPool::detach(const StringSource *t) {
+  sources.erase(std::find(sources.begin(), sources.end(), t));
+}
+
+std::string_view StringPool::intern(std::string_view s, size_t hash, const StringSource *from) {
+  for (const StringSource *t : sources) {
+    if (t == from) continue;
+    std::string_view bytes = t->find_bytes(s, hash);
+    if (bytes.data() != NULL) return bytes;
+  }
+  return arena.copy(s);
+}
+
+StringPool &shared_string_pool() {
+  static StringPool pool;
+  return pool;
+}
 
-int Entry::equal_string(std::string string, int length) const {
-  return str.compare(string) == 0;
+Entry::Entry(std::string_view s, int l, int i) : str(s.data()), len(l), index(i), hash(hash_string(s)) {}
+Entry::Entry(std::string_view s, int l, int i, size_t h) : str(s.data()), len(l), index(i), hash(h) {}
+
+int Entry::equal_string(std::string_view string, int length) const {
+  return len == length && memcmp(str, string.data(), length) == 0;
 }
 
 ostream &Entry::print(ostream &s) const {
-  return s << "{" << str << ", " << len << ", " << index << "}\n";
+  return s << "{" << get_string() << ", " << len << ", " << index << "}\n";
 }
 
 ostream &operator<<(ostream &s, const Entry &sym) {
@@ -34,8 +98,8 @@ ostream &operator<<(ostream &s, Symbol sym) {
   return s << *sym;
 }
 
-std::string Entry::get_string() const {
-  return std::string(str);
+std::string_view Entry::get_string() const {
+  return std::string_view(str, len);
 }
 
 int Entry::get_len() const {
@@ -49,10 +113,220 @@ Symbol copy_Symbol(const Symbol s) {
   return s;
 }
 
-StringEntry::StringEntry(std::string s, int l, int i) : Entry(s, l, i) {}
-IdEntry::IdEntry(std::string s, int l, int i) : Entry(s, l, i) {}
-IntEntry::IntEntry(std::string s, int l, int i) : Entry(s, l, i) {}
+StringEntry::StringEntry(std::string_view s, int l, int i) : Entry(s, l, i) {}
+StringEntry::StringEntry(std::string_view s, int l, int i, size_t h) : Entry(s, l, i, h) {}
+IdEntry::IdEntry(std::string_view s, int l, int i) : Entry(s, l, i) {}
+IdEntry::IdEntry(std::string_view s, int l, int i, size_t h) : Entry(s, l, i, h) {}
+//
+// parse_int reads a decimal integer.  It returns true if all of s is the
+// canonical spelling of the value: digits with an optional leading '-'
+// and no leading zeros.  A value outside int64_t is INT64_MAX, and text
+// that is not a number at all is 0.
+//
+static bool parse_int(std::string_view s, int64_t *value) {
+  const char *end = s.data() + s.length();
+  *value = 0;
+  std::from_chars_result r = std::from_chars(s.data(), end, *value);
+  if (r.ec == std::errc::result_out_of_range) *value = INT64_MAX;
+  if (r.ec != std::errc() || r.ptr != end) return false;
+  size_t digits = s[0] == '-' ? 1 : 0;
+  return s[digits] != '0' || (s.length() == 1);
+}
+
+IntEntry::IntEntry(std::string_view s, int l, int i) : Entry(s, l, i) {
+  parse_int(s, &value);
+}
+IntEntry::IntEntry(std::string_view s, int l, int i, size_t h) : Entry(s, l, i, h) {
+  parse_int(s, &value);
+}
+
+//
+// The value index works like the string index of StringTable, with the
+// value itself, scrambled by a multiplicative hash, as the key.
+//
+size_t IntTable::probe_value(int64_t value) const {
+  size_t mask = value_slots.size() - 1;
+  size_t slot = ((uint64_t)value * 0x9E3779B97F4A7C15ull) >> 32 & mask;
+  STRINGTAB_STAT(unsigned long n = 1);
+  while (value_slots[slot] >= 0 && (*tbl)[value_slots[slot]]->get_value() != value) {
+    slot = (slot + 1) & mask;
+    STRINGTAB_STAT(n++);
+  }
+  STRINGTAB_STAT(stats.probed(n));
+  return slot;
+}
+
+IntEntry *IntTable::add_value(int64_t value, IntEntry *e) {
+  value_slots[probe_value(value)] = e->get_index();
+  if (++values * 2 > (int)value_slots.size()) {
+    std::vector<int> old(value_slots.size() * 2, -1);
+    value_slots.swap(old);
+    for (int i : old)
+      if (i >= 0) value_slots[probe_value((*tbl)[i]->get_value())] = i;
+  }
+  return e;
+}
+
+IntEntry *IntTable::add_string(std::string_view s) {
+  int64_t value;
+  if (s.empty() || !parse_int(s, &value)) return StringTable<IntEntry>::add_string(s);
+  size_t slot = probe_value(value);
+  if (value_slots[slot] >= 0) {
+    STRINGTAB_STAT(stats.adds++);
+    STRINGTAB_STAT(stats.hits++);
+    return (*tbl)[value_slots[slot]];
+  }
+  return add_value(value, StringTable<IntEntry>::add_string(s));
+}
+
+IntEntry *IntTable::add_string(std::string_view s, int maxchars) {
+  return add_string(s.substr(0, min((int)s.length(), maxchars)));
+}
+
+//
+// Only a value that is not in the table yet is formatted, to give the new
+// entry its text.
+//
+IntEntry *IntTable::add_int(int64_t i) {
+  size_t slot = probe_value(i);
+  if (value_slots[slot] >= 0) {
+    STRINGTAB_STAT(stats.adds++);
+    STRINGTAB_STAT(stats.hits++);
+    return (*tbl)[value_slots[slot]];
+  }
+  char buf[24];
+  char *end = std::to_chars(buf, buf + sizeof(buf), i).ptr;
+  return add_value(i, StringTable<IntEntry>::add_string(std::string_view(buf, end - buf)));
+}
 
 IdTable idtable;
 IntTable inttable;
 StrTable stringtable;
+std::mutex intern_lock;
+
+// Must stay in the order of the declarations in stringtab.h, which
+// documents the index each one receives.
+const Symbol sym_self = idtable.add_string("self");
+const Symbol sym_SELF_TYPE = idtable.add_string("SELF_TYPE");
+const Symbol sym_Object = idtable.add_string("Object");
+const Symbol sym_IO = idtable.add_string("IO");
+const Symbol sym_Int = idtable.add_string("Int");
+const Symbol sym_String = idtable.add_string("String");
+const Symbol sym_Bool = idtable.add_string("Bool");
+const Symbol sym_Main = idtable.add_string("Main");
+const Symbol sym_main = idtable.add_string("main");
+const Symbol sym_no_type = idtable.add_string("_no_type");
+
+//
+// The tables never shrink, so the number of entries at the end of the run
+// is also the peak.  Probe lengths count the slots inspected, including the
+// one that ends the probe, so 1.00 slots/probe means no collisions at all.
+//
+#ifdef STRINGTAB_STATS
+template <class Elem>
+static void dump_stats(ostream &out, const char *name, const StringTable<Elem> &table, bool yaml) {
+  const StringTableStats &st = table.get_stats();
+  double avg = st.lookups ? (double)st.probes / st.lookups : 0;
+  if (yaml) {
+    out << name << ":\n"
+        << "  adds: " << st.adds << "\n"
+        << "  hits: " << st.hits << "\n"
+        << "  misses: " << st.misses << "\n"
+        << "  bytes: " << st.bytes << "\n"
+        << "  peak_entries: " << table.size() << "\n"
+        << "  lookups: " << st.lookups << "\n"
+        << "  probes: " << st.probes << "\n"
+        << "  max_probe: " << st.max_probe << "\n";
+  } else {
+    out << std::left << setw(12) << name << std::right << st.adds << " adds, " << st.hits
+        << " hits, " << st.misses << " misses, " << st.bytes << " bytes, " << table.size()
+        << " peak entries, " << std::fixed << std::setprecision(2) << avg
+        << " slots/probe (max " << st.max_probe << ")\n";
+  }
+}
+
+void dump_string_table_stats(ostream &out, bool yaml) {
+  dump_stats(out, "idtable", idtable, yaml);
+  dump_stats(out, "inttable", inttable, yaml);
+  dump_stats(out, "stringtable", stringtable, yaml);
+}
+#else
+void dump_string_table_stats(ostream &out, bool yaml) {
+  out << "No string table statistics available\n";
+}
+#endif
+
+//
+// A snapshot file holds the three tables so that a later run can map them
+// in and keep every index:
+//
+//   magic                  "COOLSYM1"
+//   hash_check             hash_string("COOLSYM1"); if a run computes a
+//                          different value, the stored hashes are unusable
+//   idtable, inttable and stringtable sections, in that order (see
+//   StringTable::write_snapshot)
+//
+// The file is written under a temporary name and renamed into place, so a
+// run that has the old snapshot mapped never sees it change.
+//
+static const char snapshot_magic[8] = {'C', 'O', 'O', 'L', 'S', 'Y', 'M', '1'};
+
+bool write_string_tables(const char *path) {
+  std::string tmp = std::string(path) + ".tmp";
+  ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  uint64_t hash_check = hash_string(std::string_view(snapshot_magic, 8));
+  out.write(snapshot_magic, 8);
+  out.write((const char *)&hash_check, sizeof(hash_check));
+  idtable.write_snapshot(out);
+  inttable.write_snapshot(out);
+  stringtable.write_snapshot(out);
+  out.close();
+  if (!out || rename(tmp.c_str(), path) != 0) {
+    cerr << "Could not write the symbol snapshot " << path << endl;
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+//
+// The file is mapped privately and read-only, and stays mapped for the
+// rest of the run since the tables refer to its bytes.
+//
+bool map_string_tables(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false; // no snapshot yet
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    cerr << "Could not map the symbol snapshot " << path << endl;
+    return false;
+  }
+
+  const char *data = (const char *)map;
+  size_t size = st.st_size;
+  size_t n = 0;
+  if (size >= 16 && memcmp(data, snapshot_magic, 8) == 0) {
+    uint64_t hash_check;
+    memcpy(&hash_check, data + 8, sizeof(hash_check));
+    bool rehash = hash_check != hash_string(std::string_view(snapshot_magic, 8));
+    size_t used = 16;
+    n = idtable.map_snapshot(data + used, size - used, rehash);
+    if (n) {
+      used += n;
+      n = inttable.map_snapshot(data + used, size - used, rehash);
+    }
+    if (n) {
+      used += n;
+      n = stringtable.map_snapshot(data + used, size - used, rehash);
+    }
+  }
+  if (n == 0) {
+    cerr << "Ignoring the malformed symbol snapshot " << path << endl;
+    return false;
+  }
+  return true;
+}
@@ -10,7 +10,12 @@
 
 #include "cool-io.h"
 #include <assert.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
 #include <string.h>
+#include <string_view>
 #include <vector>
 
 class Entry;
@@ -19,31 +24,45 @@ typedef Entry *Symbol;
 extern ostream &operator<<(ostream &s, const Entry &sym);
 extern ostream &operator<<(ostream &s, Symbol sym);
 
+// hash of the string bytes; used to index the string tables
+size_t hash_string(std::string_view s);
+
 /////////////////////////////////////////////////////////////////////////
 //
 //  String Table Entries
 //
 /////////////////////////////////////////////////////////////////////////
 
+template <class Elem> class ConcurrentStringTable;
+
 class Entry {
+  // assigns indices after the entries have been created
+  template <class Elem> friend class ConcurrentStringTable;
+
 protected:
-  std::string str; // the string
+  const char *str; // the string, stored in the shared StringPool
   int len;         // the length of the string (without trailing \0)
   int index;       // a unique index for each string
+  size_t hash;     // cached hash_string(str), so the table never rehashes
+
 public:
-  Entry(std::string s, int l, int i);
+  Entry(std::string_view s, int l, int i);
+  Entry(std::string_view s, int l, int i, size_t h); // h is hash_string(s)
 
   // is string argument equal to the str of this Entry?
-  int equal_string(std::string s, int len) const;
+  int equal_string(std::string_view s, int len) const;
 
   // is the integer argument equal to the index of this Entry?
   bool equal_index(int ind) const { return ind == index; }
+  int get_index() const { return index; }
 
   ostream &print(ostream &s) const;
 
-  // Return the str and len components of the Entry.
-  std::string get_string() const;
+  // Return the str and len components of the Entry.  The view stays
+  // valid for the life of the table; its data() is \0 terminated.
+  std::string_view get_string() const;
   int get_len() const;
+  size_t get_hash() const { return hash; }
 };
 
 //
@@ -63,46 +82,193 @@ class StringEntry : public Entry {
 public:
   void code_def(ostream &str, int stringclasstag);
   void code_ref(ostream &str);
-  StringEntry(std::string s, int l, int i);
+  StringEntry(std::string_view s, int l, int i);
+  StringEntry(std::string_view s, int l, int i, size_t h);
 };
 
 class IdEntry : public Entry {
 public:
-  IdEntry(std::string s, int l, int i);
+  IdEntry(std::string_view s, int l, int i);
+  IdEntry(std::string_view s, int l, int i, size_t h);
 };
 
 class IntEntry : public Entry {
+protected:
+  int64_t value; // the value of str, or INT64_MAX if it does not fit
 public:
   void code_def(ostream &str, int intclasstag);
   void code_ref(ostream &str);
-  IntEntry(std::string s, int l, int i);
+  IntEntry(std::string_view s, int l, int i);
+  IntEntry(std::string_view s, int l, int i, size_t h);
+
+  int64_t get_value() const { return value; }
 };
 
 typedef StringEntry *StringEntryP;
 typedef IdEntry *IdEntryP;
 typedef IntEntry *IntEntryP;
 
+//////////////////////////////////////////////////////////////////////////
+//
+//  String Arena
+//
+//////////////////////////////////////////////////////////////////////////
+
+//
+// A StringArena holds the bytes of every string in one table.  Strings
+// are copied once into large blocks that are never moved, and freed only
+// with the arena, so the views handed out stay valid for the life of the
+// table.  Each copy is followed by a \0 so that its data() can also be
+// used as a C string.
+//
+class StringArena {
+  std::vector<char *> blocks;
+  char *next;  // the first free byte in the current block
+  size_t left; // the number of free bytes in the current block
+public:
+  StringArena() : next(NULL), left(0) {}
+  ~StringArena();
+  StringArena(const StringArena &) = delete;
+  StringArena &operator=(const StringArena &) = delete;
+  std::string_view copy(std::string_view s);
+};
+
+//
+// What a table offers the StringPool: the bytes it already stores for s,
+// or an empty view with a NULL data() if it does not hold s.
+//
+class StringSource {
+public:
+  virtual std::string_view find_bytes(std::string_view s, size_t hash) const = 0;
+};
+
+//
+// A StringPool is a StringArena that stores every distinct string once.
+// idtable, inttable and stringtable all take their bytes from the one
+// pool returned by shared_string_pool(), so a class name that is also a
+// string constant, say, is stored only once.  The pool keeps no index of
+// its own: on a miss in one table, intern looks the string up in the
+// other tables attached to the pool (with the hash the caller has
+// computed anyway) and copies it only if none of them holds it.
+//
+// When built with PER_TABLE_POOL, every table has a pool of its own
+// instead, so that a string kept by several tables is stored by each.
+// bench-pool is also built that way, as bench-pool-per-table, to compare
+// the two layouts.
+//
+class StringPool {
+  StringArena arena;
+  std::vector<const StringSource *> sources; // the attached tables
+public:
+  void attach(const StringSource *t) { sources.push_back(t); }
+  void detach(const StringSource *t);
+  std::string_view intern(std::string_view s, size_t hash, const StringSource *from);
+};
+
+StringPool &shared_string_pool();
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  String Table Statistics
+//
+//////////////////////////////////////////////////////////////////////////
+
+//
+// When built with STRINGTAB_STATS, every table counts how it is used;
+// -i and -I dump the counters after the run.  Without it the counters
+// and the code updating them (wrapped in STRINGTAB_STAT) do not exist.
+//
+#ifdef STRINGTAB_STATS
+struct StringTableStats {
+  unsigned long adds;      // strings added, including ones already present
+  unsigned long hits;      // adds that found the string already present
+  unsigned long misses;    // adds that created an entry
+  unsigned long bytes;     // bytes of the new entries, with their \0; bytes
+                           // shared with another table count for both
+  unsigned long lookups;   // probes of the hash index, by adds, lookups
+                           // and the shared pool
+  unsigned long probes;    // slots inspected by all those probes
+  unsigned long max_probe; // the most slots inspected by a single probe
+  StringTableStats() : adds(0), hits(0), misses(0), bytes(0), lookups(0), probes(0), max_probe(0) {}
+
+  void probed(unsigned long n) {
+    lookups++;
+    probes += n;
+    if (n > max_probe) max_probe = n;
+  }
+};
+#define STRINGTAB_STAT(x) x
+#else
+#define STRINGTAB_STAT(x)
+#endif
+
+// dump the counters of idtable, inttable and stringtable; as YAML if yaml
+void dump_string_table_stats(ostream &out, bool yaml);
+
 //////////////////////////////////////////////////////////////////////////
 //
 //  String Tables
 //
 //////////////////////////////////////////////////////////////////////////
 
-template <class Elem> class StringTable {
+template <class Elem> class StringTable : public StringSource {
 protected:
-  std::vector<Elem *> *tbl; // a string table is a list
+  std::vector<Elem *> *tbl; // a string table is a list, kept in index order
+  std::deque<Elem> entries; // the entries themselves; a deque never moves them
   int index;                // the current index
+
+  // What lookup and size read without intern_lock: the elements of tbl
+  // and their number, stored after each new entry.  A full tbl is replaced
+  // rather than reallocated, and the old one kept, so that a lookup that
+  // loaded its elements before the switch still finds them.
+  std::atomic<Elem *const *> published;
+  std::atomic<int> published_size;
+  std::vector<std::vector<Elem *> *> retired;
+
+  // An open-addressing (linear probing) hash index over tbl.  Each slot
+  // holds the position of an entry in tbl, or -1 if the slot is empty.
+  // The number of slots is a power of two and is kept at least twice the
+  // number of entries.
+  std::vector<int> slots;
+  StringPool *pool; // the bytes of every entry
+#ifdef PER_TABLE_POOL
+  StringPool own_pool; // what pool points to
+#endif
+#ifdef STRINGTAB_STATS
+  mutable StringTableStats stats;
+#endif
+
+  // the slot holding s, or the empty slot where s would be inserted
+  size_t probe(std::string_view s, size_t hash) const;
+  void grow();
+  void replace_tbl();
+  Elem *new_entry(size_t slot, std::string_view s, size_t hash);
+
 public:
-  StringTable() : tbl(new std::vector<Elem *>), index(0) {} // an empty table
+  StringTable()
+      : tbl(new std::vector<Elem *>), index(0), published_size(0), slots(16, -1), pool(&shared_string_pool()) {
+    tbl->reserve(16);
+    published.store(tbl->data(), std::memory_order_relaxed);
+#ifdef PER_TABLE_POOL
+    pool = &own_pool;
+#endif
+    pool->attach(this);
+  } // an empty table
+  ~StringTable();
+  StringTable(const StringTable &) = delete;
+  StringTable &operator=(const StringTable &) = delete;
   // The following methods each add a string to the string table.
   // Only one copy of each string is maintained.
   // Returns a pointer to the string table entry with the string.
 
   // add the prefix of s of length maxchars
-  Elem *add_string(std::string s, int maxchars);
+  Elem *add_string(std::string_view s, int maxchars);
+
+  // add the string s
+  Elem *add_string(std::string_view s);
 
-  // add the (null terminated) string s
-  Elem *add_string(std::string s);
+  // add the string s, whose hash_string the caller has already computed
+  Elem *add_hashed(std::string_view s, size_t hash);
 
   // add the string representation of an integer
   Elem *add_int(int i);
@@ -112,8 +278,121 @@ public:
   int more(int i); // are there more indices?
   int next(int i); // next index
 
-  Elem *lookup(int index);            // lookup an element using its index
-  Elem *lookup_string(std::string s); // lookup an element using its string
+  // Range access to the entries in index order, so that a phase can walk
+  // every symbol without a lookup per index:
+  //   for (IdEntry *e : idtable) ...
+  typedef typename std::vector<Elem *>::const_iterator iterator;
+  iterator begin() const { return tbl->begin(); }
+  iterator end() const { return tbl->end(); }
+  int size() const { return published_size.load(std::memory_order_acquire); } // number of entries
+#ifdef STRINGTAB_STATS
+  const StringTableStats &get_stats() const { return stats; }
+#endif
+
+  // lookup an element using its index.  Entries are stored densely in
+  // index order, so the index is also the position of the entry in tbl;
+  // the lookup is inline so that a SymbolHandle converts in a few loads.
+  // It is safe while another thread interns.
+  Elem *lookup(int ind) const {
+    assert(ind >= 0 && ind < size()); // fail if string is not found
+    return published.load(std::memory_order_acquire)[ind];
+  }
+  Elem *lookup_string(std::string_view s); // lookup an element using its string
+  std::string_view find_bytes(std::string_view s, size_t hash) const override;
+
+  // Snapshots; see write_string_tables in stringtab.cc for the format.
+  // write_snapshot appends the table to out.  map_snapshot extends the
+  // table with the entries of a snapshot at data, whose bytes must stay
+  // mapped for the life of the table; it returns the size of the
+  // snapshot, or 0 if it is malformed or does not start with the entries
+  // already in the table.  If rehash is set, the stored hashes are ignored.
+  void write_snapshot(ostream &out) const;
+  size_t map_snapshot(const char *data, size_t size, bool rehash);
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  Concurrent String Tables
+//
+//////////////////////////////////////////////////////////////////////////
+
+//
+// A ConcurrentStringTable can be shared by threads that intern strings at
+// the same time, e.g. to parse several inputs in one process.  Strings are
+// spread over shards by hash.  Each shard has its own lock, arena and
+// open-addressing index; the lock is taken only to add a new string, and
+// finding a string that is already in the table takes no lock at all.
+//
+// Handing out indices in insertion order would make them depend on thread
+// scheduling.  Instead every add_string is tagged by an InternCursor with
+// the number of the input it came from and the position of the call within
+// that input.  Once all threads are done, number() gives each entry the
+// index it would have received had the inputs been interned one after the
+// other, in input order, by a single StringTable.  Indices, lookup(int) and
+// the range access are only meaningful after number().
+//
+// Destroying the table frees its entries, their bytes and every index
+// it has used; no add_string may be running then.
+//
+struct InternCursor {
+  uint32_t input; // the number of the input being interned
+  uint32_t seq;   // the number of strings interned from it so far
+  InternCursor(uint32_t in) : input(in), seq(0) {}
+};
+
+template <class Elem> class ConcurrentStringTable {
+protected:
+  enum { SHARD_BITS = 6, SHARDS = 1 << SHARD_BITS };
+
+  struct Node {
+    Elem *elem;
+    std::atomic<uint64_t> first; // smallest (input, seq) that added elem
+  };
+
+  // An index that readers probe without the lock.  Writers publish a node
+  // into an empty slot only after the node is complete, and a full index
+  // is replaced, never modified in place.
+  struct Slots {
+    size_t mask;
+    std::atomic<Node *> *slot;
+  };
+
+  struct Shard {
+    std::mutex lock;              // held to add a string
+    std::atomic<Slots *> slots;   // the current index
+    std::vector<Slots *> retired; // replaced indices; readers may still probe them
+    std::vector<Node *> nodes;    // every node in the shard
+    StringArena arena;            // the bytes of every entry in the shard
+  };
+
+  Shard shards[SHARDS];
+  std::vector<Elem *> tbl; // the entries in index order, filled by number()
+
+  static Slots *new_slots(size_t size);
+  static Node *probe(const Slots *slots, std::string_view s, size_t hash, size_t *empty);
+  static void grow(Shard &shard);
+  Shard &shard_of(size_t hash) { return shards[hash >> (sizeof(size_t) * 8 - SHARD_BITS)]; }
+
+public:
+  ConcurrentStringTable();
+  ~ConcurrentStringTable();
+  ConcurrentStringTable(const ConcurrentStringTable &) = delete;
+  ConcurrentStringTable &operator=(const ConcurrentStringTable &) = delete;
+
+  // add s on behalf of the input described by cursor; safe to call from
+  // several threads at once
+  Elem *add_string(std::string_view s, InternCursor &cursor);
+  Elem *lookup_string(std::string_view s); // lookup an element using its string
+
+  // give every entry its deterministic index; no add_string may run
+  // concurrently with it
+  void number();
+
+  typedef typename std::vector<Elem *>::const_iterator iterator;
+  iterator begin() const { return tbl.begin(); }
+  iterator end() const { return tbl.end(); }
+  int size() const { return tbl.size(); }
+  Elem *lookup(int index); // lookup an element using its index
 };
 
 class IdTable : public StringTable<IdEntry> {};
@@ -123,12 +402,124 @@ public:
   void code_string_table(ostream &, int classtag);
 };
 
+//
+// IntTable also indexes its entries by value, so that interning a number
+// needs neither formatting nor hashing its text.  Only entries spelled
+// the way add_int would spell them are in the value index; a literal
+// such as 007 is still its own entry, found by its spelling.
+//
 class IntTable : public StringTable<IntEntry> {
+protected:
+  std::vector<int> value_slots; // positions in tbl, or -1 if empty
+  int values;                   // the number of used value_slots
+
+  size_t probe_value(int64_t value) const;
+  IntEntry *add_value(int64_t value, IntEntry *e);
+
 public:
+  IntTable() : value_slots(16, -1), values(0) {}
   void code_string_table(ostream &, int classtag);
+
+  // add an integer literal as spelled in the source
+  IntEntry *add_string(std::string_view s);
+  // add the prefix of s of length maxchars
+  IntEntry *add_string(std::string_view s, int maxchars);
+  // add the string representation of an integer
+  IntEntry *add_int(int64_t i);
 };
 
 extern IdTable idtable;
 extern IntTable inttable;
 extern StrTable stringtable;
+
+// The three tables and the pool behind them take one writer at a time.
+// Code that interns into them from several threads at once (parses run
+// on threads of their own, say) holds intern_lock while it does, so the
+// interning of concurrent parses is serialized; each parse holds it for
+// one token at a time.  lookup and size, and so SymbolHandle, need no
+// lock.  Anything else that reads a table (lookup_string, the iterators)
+// must not overlap interning.
+//
+// ConcurrentStringTable would let the parses intern in parallel, but its
+// indices exist only once every input is done (see number), and the
+// global tables hand out an index with each symbol, for SymbolHandle and
+// snapshots.
+extern std::mutex intern_lock;
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  Symbol Handles
+//
+//////////////////////////////////////////////////////////////////////////
+
+//
+// A SymbolHandle is a 32-bit stand-in for a Symbol of one of the three
+// global tables: the table is kept in the top two bits and the index in
+// the rest.  A handle converts implicitly to and from a Symbol, so AST
+// nodes built with COMPACT_SYMBOLS can store handles in their fields
+// (see SymbolField in cool-tree.handcode.h) while every user of those
+// fields keeps working with Symbols.
+//
+class SymbolHandle {
+  enum { ID_TABLE, INT_TABLE, STR_TABLE, NO_TABLE };
+  enum { INDEX_BITS = 30, INDEX_MASK = (1 << INDEX_BITS) - 1 };
+  uint32_t bits;
+
+public:
+  SymbolHandle(Symbol sym);
+  operator Symbol() const;
+};
+
+//
+// An Entry does not know its table, but only the table it belongs to
+// holds it at its index, which takes at most three loads to find out.
+//
+inline SymbolHandle::SymbolHandle(Symbol sym) {
+  if (sym == NULL) {
+    bits = (uint32_t)NO_TABLE << INDEX_BITS;
+    return;
+  }
+  int i = sym->get_index();
+  assert(i <= INDEX_MASK);
+  if (i < idtable.size() && idtable.lookup(i) == sym) {
+    bits = (uint32_t)ID_TABLE << INDEX_BITS | i;
+  } else if (i < inttable.size() && inttable.lookup(i) == sym) {
+    bits = (uint32_t)INT_TABLE << INDEX_BITS | i;
+  } else {
+    assert(stringtable.lookup(i) == sym); // fail if sym is in no global table
+    bits = (uint32_t)STR_TABLE << INDEX_BITS | i;
+  }
+}
+
+inline SymbolHandle::operator Symbol() const {
+  switch (bits >> INDEX_BITS) {
+  case ID_TABLE: return idtable.lookup(bits & INDEX_MASK);
+  case INT_TABLE: return inttable.lookup(bits & INDEX_MASK);
+  case STR_TABLE: return stringtable.lookup(bits & INDEX_MASK);
+  default: return NULL;
+  }
+}
+
+// Save the three tables to a snapshot file after a run, and map one back
+// in at startup so later runs keep the same indices without re-interning.
+bool write_string_tables(const char *path);
+bool map_string_tables(const char *path);
+
+//
+// Identifiers that the compiler itself refers to are interned once at
+// startup, before any input is read.  They hold the first indices of
+// idtable, in the order they are declared here.  Each is named sym_
+// and the identifier, so that they stay clear of the names later phases
+// declare for themselves.
+//
+extern const Symbol sym_self;      // index 0
+extern const Symbol sym_SELF_TYPE; // index 1
+extern const Symbol sym_Object;    // index 2
+extern const Symbol sym_IO;        // index 3
+extern const Symbol sym_Int;       // index 4
+extern const Symbol sym_String;    // index 5
+extern const Symbol sym_Bool;      // index 6
+extern const Symbol sym_Main;      // index 7
+extern const Symbol sym_main;      // index 8
+extern const Symbol sym_no_type;   // index 9, "_no_type"
 #endif
@@ -5,6 +5,8 @@
 #include "copyright.h"
 
 #include "cool-io.h"
+#include <algorithm>
+#include <charconv>
 #define MAXSIZE   1000000
 #define min(a, b) (a > b ? b : a)
 
@@ -13,62 +15,209 @@
 #include <vector>
 
 //
-// A string table is implemented a linked list of Entrys.  Each Entry
-// in the list has a unique string.
+// A string table is implemented as a vector of Entrys.  Each Entry
+// in the vector has a unique string.  An open-addressing hash index
+// (slots) maps the bytes of a string to its position in the vector,
+// so adding and looking up strings does not scan the table.
 //
 
-template <class Elem> Elem *StringTable<Elem>::add_string(std::string s) {
+template <class Elem> Elem *StringTable<Elem>::add_string(std::string_view s) {
   return add_string(s, MAXSIZE);
 }
 
 //
-// Add a string requires two steps.  First, the list is searched; if the
+// probe walks the slots from the home slot of hash until it finds the
+// entry holding s or an empty slot.  The table is never more than half
+// full, so the walk always terminates and stays short.
+//
+template <class Elem> size_t StringTable<Elem>::probe(std::string_view s, size_t hash) const {
+  size_t mask = slots.size() - 1;
+  size_t slot = hash & mask;
+  int len = s.length();
+  STRINGTAB_STAT(unsigned long n = 1);
+  while (slots[slot] >= 0) {
+    Elem *entry = (*tbl)[slots[slot]];
+    if (entry->get_hash() == hash && entry->equal_string(s, len)) break;
+    slot = (slot + 1) & mask;
+    STRINGTAB_STAT(n++);
+  }
+  STRINGTAB_STAT(stats.probed(n));
+  return slot;
+}
+
+//
+// grow doubles the number of slots (more than once if many entries were
+// added at a time) and reinserts every entry using the hash cached in
+// the Entry.
+//
+template <class Elem> void StringTable<Elem>::grow() {
+  size_t size = slots.size() * 2;
+  while (size < tbl->size() * 2)
+    size *= 2;
+  std::vector<int> old(size, -1);
+  slots.swap(old);
+  size_t mask = slots.size() - 1;
+  for (size_t i = 0; i < tbl->size(); i++) {
+    size_t slot = (*tbl)[i]->get_hash() & mask;
+    while (slots[slot] >= 0)
+      slot = (slot + 1) & mask;
+    slots[slot] = i;
+  }
+}
+
+//
+// Add a string requires two steps.  First, the index is searched; if the
 // string is found, a pointer to the existing Entry for that string is
 // returned.  If the string is not found, a new Entry is created and added
-// to the list.
+// to the vector and the index.
 //
-template <class Elem> Elem *StringTable<Elem>::add_string(std::string s, int maxchars) {
+template <class Elem> Elem *StringTable<Elem>::add_string(std::string_view s, int maxchars) {
   int len = min((int)s.length(), maxchars);
-  for (auto &entry : *tbl)
-    if (entry->equal_string(s, len)) return entry;
+  std::string_view key = s.substr(0, len);
+  return add_hashed(key, hash_string(key));
+}
+
+template <class Elem> Elem *StringTable<Elem>::add_hashed(std::string_view s, size_t hash) {
+  size_t slot = probe(s, hash);
+  STRINGTAB_STAT(stats.adds++);
+  if (slots[slot] >= 0) {
+    STRINGTAB_STAT(stats.hits++);
+    return (*tbl)[slots[slot]];
+  }
+
+  STRINGTAB_STAT(stats.misses++);
+  STRINGTAB_STAT(stats.bytes += s.length() + 1);
+  return new_entry(slot, pool->intern(s, hash, this), hash);
+}
 
-  Elem *e = new Elem(s, len, index++);
+//
+// new_entry appends an entry for s, whose bytes are already stored for
+// good, at the empty slot returned by probe.  The Entry objects are kept
+// in a deque rather than allocated one at a time, so each costs only its
+// own size.
+//
+template <class Elem> Elem *StringTable<Elem>::new_entry(size_t slot, std::string_view s, size_t hash) {
+  Elem *e = &entries.emplace_back(s, s.length(), index++, hash);
+  slots[slot] = tbl->size();
+  if (tbl->size() == tbl->capacity()) replace_tbl();
   tbl->push_back(e);
+  published_size.store(index, std::memory_order_release);
+  if (tbl->size() * 2 > slots.size()) grow();
   return e;
 }
 
+template <class Elem> StringTable<Elem>::~StringTable() {
+  pool->detach(this);
+  delete tbl;
+  for (std::vector<Elem *> *old : retired)
+    delete old;
+}
+
 //
-// To look up a string, the list is scanned until a matching Entry is located.
-// If no such entry is found, an assertion failure occurs.  Thus, this function
-// is used only for strings that one expects to find in the table.
+// replace_tbl copies the full tbl into one twice its size and publishes
+// that.  The old one is kept, as lookups may still be reading it.
 //
-template <class Elem> Elem *StringTable<Elem>::lookup_string(std::string s) {
-  int len = s.length();
-  for (auto &entry : *tbl)
-    if (entry->equal_string(s, len)) return entry;
-  assert(0);   // fail if string is not found
-  return NULL; // to avoid compiler warning
+template <class Elem> void StringTable<Elem>::replace_tbl() {
+  std::vector<Elem *> *bigger = new std::vector<Elem *>;
+  bigger->reserve(tbl->capacity() * 2);
+  bigger->assign(tbl->begin(), tbl->end());
+  retired.push_back(tbl);
+  tbl = bigger;
+  published.store(tbl->data(), std::memory_order_release);
 }
 
 //
-// lookup is similar to lookup_string, but uses the index of the string
-// as the key.
+// To look up a string, the index is probed until a matching Entry is located.
+// If no such entry is found, an assertion failure occurs.  Thus, this function
+// is used only for strings that one expects to find in the table.
 //
-template <class Elem> Elem *StringTable<Elem>::lookup(int ind) {
-  for (auto &entry : *tbl)
-    if (entry->equal_index(ind)) return entry;
+template <class Elem> Elem *StringTable<Elem>::lookup_string(std::string_view s) {
+  size_t slot = probe(s, hash_string(s));
+  if (slots[slot] >= 0) return (*tbl)[slots[slot]];
   assert(0);   // fail if string is not found
   return NULL; // to avoid compiler warning
 }
 
+template <class Elem> std::string_view StringTable<Elem>::find_bytes(std::string_view s, size_t hash) const {
+  size_t slot = probe(s, hash);
+  return slots[slot] >= 0 ? (*tbl)[slots[slot]]->get_string() : std::string_view();
+}
+
 //
 // add_int adds the string representation of an integer to the list.
+// IntTable replaces it with a version that looks the value up first.
 //
 template <class Elem> Elem *StringTable<Elem>::add_int(int i) {
-  static char *buf = new char[20];
-  snprintf(buf, 20, "%d", i);
-  return add_string(buf);
+  char buf[20];
+  char *end = std::to_chars(buf, buf + sizeof(buf), i).ptr;
+  return add_string(std::string_view(buf, end - buf));
+}
+//
+// A table is written as a snapshot section (all fields are native 64-bit
+// words):
+//
+//   count                  the number of entries
+//   bytes                  the size of the string area
+//   hash[count]            hash_string of each entry
+//   offset[count + 1]      where each entry starts in the string area
+//   strings[bytes]         the \0 terminated entries, padded to 8 bytes
+//
+template <class Elem> void StringTable<Elem>::write_snapshot(ostream &out) const {
+  uint64_t count = tbl->size();
+  uint64_t bytes = 0;
+  for (Elem *e : *tbl)
+    bytes += e->get_len() + 1;
+  out.write((const char *)&count, sizeof(count));
+  out.write((const char *)&bytes, sizeof(bytes));
+  for (Elem *e : *tbl) {
+    uint64_t hash = e->get_hash();
+    out.write((const char *)&hash, sizeof(hash));
+  }
+  uint64_t offset = 0;
+  for (Elem *e : *tbl) {
+    out.write((const char *)&offset, sizeof(offset));
+    offset += e->get_len() + 1;
+  }
+  out.write((const char *)&offset, sizeof(offset));
+  for (Elem *e : *tbl)
+    out.write(e->get_string().data(), e->get_len() + 1); // with its \0
+  out.write("\0\0\0\0\0\0\0", -bytes & 7);
+}
+
+//
+// The new entries refer to the mapped bytes directly; nothing but the
+// Entry objects and the hash index is allocated.  A snapshot found to be
+// malformed part way through leaves the entries mapped so far in place;
+// they are valid entries, just not all of them.
+//
+template <class Elem> size_t StringTable<Elem>::map_snapshot(const char *data, size_t size, bool rehash) {
+  const uint64_t *words = (const uint64_t *)data;
+  if (size < 3 * sizeof(uint64_t)) return 0;
+  uint64_t count = words[0];
+  uint64_t bytes = words[1];
+  if (count > size / (2 * sizeof(uint64_t)) || bytes > size || count < tbl->size()) return 0;
+  const uint64_t *hashes = words + 2;
+  const uint64_t *offsets = hashes + count;
+  const char *strings = (const char *)(offsets + count + 1);
+  size_t total = (strings - data) + ((bytes + 7) & ~(uint64_t)7);
+  if (total > size || offsets[count] != bytes) return 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (offsets[i] >= offsets[i + 1] || strings[offsets[i + 1] - 1] != '\0') return 0;
+    std::string_view s(strings + offsets[i], offsets[i + 1] - offsets[i] - 1);
+    if (i < tbl->size()) {
+      // the entries interned before the snapshot was mapped must match it
+      if ((*tbl)[i]->get_string() != s) return 0;
+      continue;
+    }
+    size_t hash = rehash ? hash_string(s) : hashes[i];
+    size_t slot = probe(s, hash);
+    if (slots[slot] >= 0) return 0; // each string occurs once
+    new_entry(slot, s, hash);
+  }
+  return total;
 }
+
 template <class Elem> int StringTable<Elem>::first() {
   return 0;
 }
@@ -81,3 +230,140 @@ template <class Elem> int StringTable<Elem>::next(int i) {
   assert(i < index);
   return i + 1;
 }
+
+//
+// ConcurrentStringTable
+//
+// Every shard starts with a small index.  Like StringTable, an index is
+// kept at most half full, so probes always reach an empty slot.
+//
+template <class Elem> ConcurrentStringTable<Elem>::ConcurrentStringTable() {
+  for (Shard &shard : shards)
+    shard.slots.store(new_slots(16), std::memory_order_relaxed);
+}
+
+//
+// The current index of each shard is freed along with the retired ones.
+// The bytes of the entries go with the shards' arenas.
+//
+template <class Elem> ConcurrentStringTable<Elem>::~ConcurrentStringTable() {
+  for (Shard &shard : shards) {
+    for (Node *node : shard.nodes) {
+      delete node->elem;
+      delete node;
+    }
+    shard.retired.push_back(shard.slots.load(std::memory_order_relaxed));
+    for (Slots *slots : shard.retired) {
+      delete[] slots->slot;
+      delete slots;
+    }
+  }
+}
+
+template <class Elem>
+typename ConcurrentStringTable<Elem>::Slots *ConcurrentStringTable<Elem>::new_slots(size_t size) {
+  Slots *slots = new Slots;
+  slots->mask = size - 1;
+  slots->slot = new std::atomic<Node *>[size]();
+  return slots;
+}
+
+//
+// probe returns the node holding s, or NULL if s is not in slots.  In the
+// latter case *empty (when given) is set to the slot where s belongs.
+//
+template <class Elem>
+typename ConcurrentStringTable<Elem>::Node *
+ConcurrentStringTable<Elem>::probe(const Slots *slots, std::string_view s, size_t hash, size_t *empty) {
+  size_t slot = hash & slots->mask;
+  int len = s.length();
+  for (;; slot = (slot + 1) & slots->mask) {
+    Node *node = slots->slot[slot].load(std::memory_order_acquire);
+    if (node == NULL) break;
+    if (node->elem->get_hash() == hash && node->elem->equal_string(s, len)) return node;
+  }
+  if (empty) *empty = slot;
+  return NULL;
+}
+
+//
+// grow builds an index twice the size and publishes it.  The old index is
+// kept, since readers that loaded it before the switch may still probe it;
+// a reader that misses there retries under the lock against the new one.
+// Called with the shard's lock held.
+//
+template <class Elem> void ConcurrentStringTable<Elem>::grow(Shard &shard) {
+  Slots *old = shard.slots.load(std::memory_order_relaxed);
+  Slots *slots = new_slots((old->mask + 1) * 2);
+  for (Node *node : shard.nodes) {
+    size_t slot = node->elem->get_hash() & slots->mask;
+    while (slots->slot[slot].load(std::memory_order_relaxed) != NULL)
+      slot = (slot + 1) & slots->mask;
+    slots->slot[slot].store(node, std::memory_order_relaxed);
+  }
+  shard.slots.store(slots, std::memory_order_release);
+  shard.retired.push_back(old);
+}
+
+//
+// add_string first probes the shard without the lock.  Only a miss takes
+// the lock, probes again (another thread may have added s meanwhile) and
+// adds a new entry.  Either way the entry remembers the smallest
+// (input, seq) pair that added it, which is what number() sorts on.
+//
+template <class Elem>
+Elem *ConcurrentStringTable<Elem>::add_string(std::string_view s, InternCursor &cursor) {
+  uint64_t key = ((uint64_t)cursor.input << 32) | cursor.seq++;
+  size_t hash = hash_string(s);
+  Shard &shard = shard_of(hash);
+  Node *node = probe(shard.slots.load(std::memory_order_acquire), s, hash, NULL);
+  if (node == NULL) {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Slots *slots = shard.slots.load(std::memory_order_relaxed);
+    size_t empty;
+    node = probe(slots, s, hash, &empty);
+    if (node == NULL) {
+      node = new Node;
+      node->elem = new Elem(shard.arena.copy(s), s.length(), -1);
+      node->first.store(key, std::memory_order_relaxed);
+      shard.nodes.push_back(node);
+      slots->slot[empty].store(node, std::memory_order_release);
+      if (shard.nodes.size() * 2 > slots->mask + 1) grow(shard);
+      return node->elem;
+    }
+  }
+  uint64_t first = node->first.load(std::memory_order_relaxed);
+  while (key < first && !node->first.compare_exchange_weak(first, key, std::memory_order_relaxed))
+    ;
+  return node->elem;
+}
+
+template <class Elem> Elem *ConcurrentStringTable<Elem>::lookup_string(std::string_view s) {
+  size_t hash = hash_string(s);
+  Node *node = probe(shard_of(hash).slots.load(std::memory_order_acquire), s, hash, NULL);
+  assert(node != NULL); // fail if string is not found
+  return node->elem;
+}
+
+//
+// number sorts the entries of every shard on the (input, seq) pair that
+// first added them, and uses the position as the index.
+//
+template <class Elem> void ConcurrentStringTable<Elem>::number() {
+  std::vector<Node *> all;
+  for (Shard &shard : shards)
+    all.insert(all.end(), shard.nodes.begin(), shard.nodes.end());
+  std::sort(all.begin(), all.end(), [](Node *a, Node *b) {
+    return a->first.load(std::memory_order_relaxed) < b->first.load(std::memory_order_relaxed);
+  });
+  tbl.clear();
+  for (Node *node : all) {
+    node->elem->index = tbl.size();
+    tbl.push_back(node->elem);
+  }
+}
+
+template <class Elem> Elem *ConcurrentStringTable<Elem>::lookup(int ind) {
+  assert(ind >= 0 && ind < (int)tbl.size()); // fail if string is not found
+  return tbl[ind];
+}
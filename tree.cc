@@ -14,8 +14,9 @@
 
 #include "tree.h"
 
-/* line number to assign to the current node being constructed */
-int node_lineno = 1;
+/* line number to assign to the current node being constructed; one per
+   thread, so that threads can build trees at the same time */
+thread_local int node_lineno = 1;
 
 ///////////////////////////////////////////////////////////////////////////
 //
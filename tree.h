@@ -61,6 +61,20 @@ public:
   tree_node *set(tree_node *);
 };
 
+///////////////////////////////////////////////////////////////////////////
+//
+// to_csubstr
+//
+// A view of the bytes of a symbol for use as a YAML scalar.  The bytes
+// live in the string tables for the whole run, so a YAML node can refer
+// to them instead of copying them into the tree's arena.
+//
+///////////////////////////////////////////////////////////////////////////
+inline c4::csubstr to_csubstr(Symbol sym) {
+  std::string_view s = sym->get_string();
+  return c4::csubstr(s.data(), s.length());
+}
+
 ///////////////////////////////////////////////////////////////////
 //  Lists of APS objects are implemented by the STL List.
 //  The STL list contains excellent documentation that you
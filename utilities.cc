@@ -12,8 +12,12 @@
 //
 //  This file contains:
 //      get_escaped_string   print a string showing escape characters
+//      get_unescaped_string undo get_escaped_string
+//      cool_token_from_string the token named by a token stream kind
 //      print_cool_token       print a cool token and its semantic value
 //      dump_cool_token        dump a readable token representation
+//      build_binary_token     add a token to a binary token stream
+//      write_binary_tokens    write a binary token stream
 //      strdup                 duplicate a string (missing from some libraries)
 //
 ///////////////////////////////////////////////////////////////////////////////
@@ -21,8 +25,11 @@
 #include "cool-io.h"    // for cerr, <<, manipulators
 #include "cool-parse.h" // defines tokens
 #include "stringtab.h"  // Symbol <-> String conversions
+#include <array>
 #include <ctype.h>      // for isprint
-#include <regex>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "utilities.h"
 
@@ -34,84 +41,158 @@ static const char *padding =
 //             1         2         3         4         5         6         7
 // 80 spaces for padding
 
-string get_escaped_string(std::string s) {
-  std::ostringstream str;
-  for (auto ch = s.begin(); ch != s.end(); ++ch) {
-    switch (*ch) {
-    case '\\': str << "\\\\"; break;
-    case '\"': str << "\\\""; break;
-    case '\n': str << "\\n"; break;
-    case '\t': str << "\\t"; break;
-    case '\b': str << "\\b"; break;
-    case '\f': str << "\\f"; break;
-
-    default:
-      if (isprint(*ch))
-        str << *ch;
-      else
-        //
-        // Unprintable characters are printed using octal equivalents.
-        // To get the sign of the octal number correct, the character
-        // must be cast to an unsigned char before coverting it to an
-        // integer.
-        //
-        str << '\\' << oct << setfill('0') << setw(3) << (int)((unsigned char)(*ch));
-      break;
+//
+// get_escaped_string writes s into out with escapes for the characters
+// that cannot appear as themselves: \\, \", the usual control escapes,
+// and \ooo for other unprintable bytes.  Printable runs are found 16
+// bytes at a time (with SSE2 where it is available) and copied whole.
+// out is overwritten, so a caller can reuse one buffer for every string.
+//
+static void escape_char(unsigned char ch, std::string &out) {
+  switch (ch) {
+  case '\\': out += "\\\\"; break;
+  case '\"': out += "\\\""; break;
+  case '\n': out += "\\n"; break;
+  case '\t': out += "\\t"; break;
+  case '\b': out += "\\b"; break;
+  case '\f': out += "\\f"; break;
+  default:
+    if (isprint(ch)) {
+      out += ch;
+    } else {
+      //
+      // Unprintable characters are printed using octal equivalents.
+      //
+      char octal[4] = {'\\', (char)('0' + (ch >> 6)), (char)('0' + ((ch >> 3) & 7)), (char)('0' + (ch & 7))};
+      out.append(octal, 4);
     }
+    break;
+  }
+}
+
+// the length of the run of bytes at p, before end, that need no escape
+static size_t printable_run(const char *p, const char *end) {
+  const char *start = p;
+#ifdef __SSE2__
+  const __m128i space = _mm_set1_epi8(' ' - 1), del = _mm_set1_epi8(0x7f);
+  const __m128i backslash = _mm_set1_epi8('\\'), quote = _mm_set1_epi8('\"');
+  for (; end - p >= 16; p += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *)p);
+    // bytes from 0x80 up are negative, so they fail the first test
+    __m128i plain = _mm_and_si128(_mm_cmpgt_epi8(b, space), _mm_cmplt_epi8(b, del));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(b, backslash), _mm_cmpeq_epi8(b, quote));
+    unsigned mask = _mm_movemask_epi8(_mm_andnot_si128(special, plain)) ^ 0xffff;
+    if (mask != 0) return p - start + __builtin_ctz(mask);
   }
-  return str.str();
+#endif
+  for (; p < end; p++)
+    if (*p < ' ' || *p > '~' || *p == '\\' || *p == '\"') break;
+  return p - start;
 }
 
-const std::regex octal_pattern("^[0-3][0-7]{2}$");
+void get_escaped_string(std::string_view s, std::string &out) {
+  out.clear();
+  out.reserve(s.length());
+  const char *p = s.data(), *end = p + s.length();
+  while (p < end) {
+    size_t run = printable_run(p, end);
+    out.append(p, run);
+    p += run;
+    if (p < end) escape_char(*p++, out);
+  }
+}
 
-string get_unescaped_string(std::string s) {
-  std::ostringstream str;
-  for (size_t i = 0; i < s.length(); ++i) {
-    // The default case is that there is not an escape sequence
-    if (s[i] != '\\') {
-      str << s[i];
-      continue;
-    }
+string get_escaped_string(std::string_view s) {
+  std::string out;
+  get_escaped_string(s, out);
+  return out;
+}
 
-    // If the current byte is a backslash, we check for an escape sequence.
-    // The backslash is consumed, and the following 1 or 3 bytes are pattern
-    // matched and unescaped if needed.
-    i++;
-    if (i == s.length()) {
-      // Any backslash should be followed by at least one byte in a cool string
-      // literal.
-      cerr << "Unexpected end of string" << endl;
-      return "";
+//
+// The diagnostics of get_unescaped_string.  p is just past a backslash;
+// valid_escape returns the number of bytes after p that the escape uses,
+// or -1 after printing why it is malformed (if report is set).
+//
+static int unexpected_end(bool report) {
+  // Any backslash should be followed by at least one byte in a cool string
+  // literal.
+  if (report) cerr << "Unexpected end of string" << endl;
+  return -1;
+}
+
+static int unexpected_escape(bool report) {
+  // If this catch-all case still not matches a legal escape sequence,
+  // give up here and emit an error message
+  if (report)
+    cerr << "Unexpected escape sequence; expected \\\\, \\\", \\n, \\t, "
+            "\\b, \\f, or \\xxx where xxx is an octal number"
+         << endl;
+  return -1;
+}
+
+static inline int valid_escape(const char *p, const char *end, bool report) {
+  if (p == end) return unexpected_end(report);
+  switch (*p) {
+  case '\\':
+  case '\"':
+  case 'n':
+  case 't':
+  case 'b':
+  case 'f': return 0;
+  }
+  // Non-printable characters are represented as octal numbers
+  // left-padded with leading zeros with a width of 3
+  if (end - p < 3 || p[0] < '0' || p[0] > '3' || p[1] < '0' || p[1] > '7' || p[2] < '0' || p[2] > '7')
+    return unexpected_escape(report);
+  return 2;
+}
+
+//
+// get_unescaped_string undoes get_escaped_string, writing the result into
+// out so that a caller can reuse one buffer for every string.  memchr
+// (which the C library implements with vector instructions) finds each
+// backslash, and the run before it is copied in one go.  On a malformed
+// escape it prints a message (if report is set), leaves out empty, and
+// returns false.
+//
+bool get_unescaped_string(std::string_view s, std::string &out, bool report) {
+  out.resize(s.length()); // the unescaped string is never longer
+  char *dst = out.data();
+  const char *p = s.data(), *end = p + s.length();
+  while (p < end) {
+    const char *backslash = (const char *)memchr(p, '\\', end - p);
+    if (backslash == NULL) backslash = end;
+    memcpy(dst, p, backslash - p);
+    dst += backslash - p;
+    if (backslash == end) break;
+
+    // The backslash is consumed, and the following 1 or 3 bytes are
+    // unescaped.
+    p = backslash + 1;
+    int used = valid_escape(p, end, report);
+    if (used < 0) {
+      out.clear();
+      return false;
     }
-    switch (s[i]) {
-    case '\\': str << "\\"; break;
-    case '\"': str << "\""; break;
-    case 'n': str << "\n"; break;
-    case 't': str << "\t"; break;
-    case 'b': str << "\b"; break;
-    case 'f': str << "\f"; break;
-    default:
-      // Non-printable characters are represented as octal numbers
-      // left-padded with leading zeros with a width of 3
-      std::string oct_string = s.substr(i, 3);
-      // Check if there is a octal escape sequence, and convert it if it is one
-      if (!std::regex_match(oct_string, octal_pattern)) {
-        // If this catch-all case still not matches a legal escape sequence,
-        // give up here and emit an error message
-        cerr << "Unexpected escape sequence; expected \\\\, \\\", \\n, \\t, "
-                "\\b, \\f, or \\xxx where xxx is an octal number"
-             << endl;
-        return "";
-      }
-      unsigned char num = stoi(oct_string, 0, 8);
-      // Advance by 3 bytes since an octal number string consumes 4 bytes,
-      // while it is only increment by 1 in the for loop
-      i += 3;
-      str << num;
-      break;
+    switch (*p) {
+    case '\\': *dst++ = '\\'; break;
+    case '\"': *dst++ = '\"'; break;
+    case 'n': *dst++ = '\n'; break;
+    case 't': *dst++ = '\t'; break;
+    case 'b': *dst++ = '\b'; break;
+    case 'f': *dst++ = '\f'; break;
+    default: *dst++ = (p[0] - '0') * 64 + (p[1] - '0') * 8 + (p[2] - '0'); break;
     }
+    p += used + 1;
   }
-  return str.str();
+  out.resize(dst - out.data());
+  return true;
+}
+
+string get_unescaped_string(std::string_view s) {
+  std::string out;
+  get_unescaped_string(s, out);
+  return out;
 }
 
 //
@@ -166,7 +247,57 @@ const char *cool_token_to_string(int tok) {
   }
 }
 
-void print_cool_token(int tok) {
+//
+// cool_token_from_string is the inverse of cool_token_to_string, for the
+// kinds named in a token stream; it returns -1 if kind names no token.
+// The kinds are placed in token_kinds by a hash of their length and end
+// characters that is perfect for this set (the table is built at compile
+// time, and a collision would fail the build), so a lookup is one hash
+// and one compare of kind in place.
+//
+struct token_kind {
+  const char *name;
+  size_t len;
+  int token;
+};
+
+static constexpr size_t token_kind_hash(const char *s, size_t len) {
+  return (len * 14 + (unsigned char)s[0] * 3 + (unsigned char)s[len - 1] * 4) & 127;
+}
+
+static constexpr std::array<token_kind, 128> token_kinds = [] {
+  const token_kind kinds[] = {
+      {"EOF", 3, 0},         {"CLASS", 5, CLASS},       {"ELSE", 4, ELSE},
+      {"FI", 2, FI},         {"IF", 2, IF},             {"IN", 2, IN},
+      {"INHERITS", 8, INHERITS}, {"LET", 3, LET},       {"LOOP", 4, LOOP},
+      {"POOL", 4, POOL},     {"THEN", 4, THEN},         {"WHILE", 5, WHILE},
+      {"ASSIGN", 6, ASSIGN}, {"CASE", 4, CASE},         {"ESAC", 4, ESAC},
+      {"OF", 2, OF},         {"DARROW", 6, DARROW},     {"NEW", 3, NEW},
+      {"STR_CONST", 9, STR_CONST}, {"INT_CONST", 9, INT_CONST},
+      {"BOOL_CONST", 10, BOOL_CONST}, {"TYPEID", 6, TYPEID},
+      {"OBJECTID", 8, OBJECTID}, {"ERROR", 5, ERROR},   {"LE", 2, LE},
+      {"NOT", 3, NOT},       {"ISVOID", 6, ISVOID},
+      {"+", 1, '+'}, {"/", 1, '/'}, {"-", 1, '-'}, {"*", 1, '*'}, {"=", 1, '='},
+      {"<", 1, '<'}, {".", 1, '.'}, {"~", 1, '~'}, {",", 1, ','}, {";", 1, ';'},
+      {":", 1, ':'}, {"(", 1, '('}, {")", 1, ')'}, {"@", 1, '@'}, {"{", 1, '{'},
+      {"}", 1, '}'},
+  };
+  std::array<token_kind, 128> table{};
+  for (const token_kind &k : kinds) {
+    token_kind &slot = table[token_kind_hash(k.name, k.len)];
+    if (slot.name != NULL) throw "token_kind_hash is not perfect";
+    slot = k;
+  }
+  return table;
+}();
+
+int cool_token_from_string(c4::csubstr kind) {
+  if (kind.len == 0) return -1;
+  const token_kind &k = token_kinds[token_kind_hash(kind.str, kind.len)];
+  return k.len == kind.len && memcmp(k.name, kind.str, kind.len) == 0 ? k.token : -1;
+}
+
+void print_cool_token(int tok, const YYSTYPE &yylval) {
   const char *tok_string = cool_token_to_string(tok);
   if (strlen(tok_string) == 1) {
     // Single character tokens should be quoted
@@ -179,31 +310,34 @@ void print_cool_token(int tok) {
   case (STR_CONST):
     cerr << " = ";
     cerr << " \"";
-    cerr << (cool_yylval.symbol->get_string());
+    cerr << (yylval.symbol->get_string());
     cerr << "\"";
 #ifdef CHECK_TABLES
-    stringtable.lookup_string(cool_yylval.symbol->get_string());
+    stringtable.lookup_string(yylval.symbol->get_string());
 #endif
     break;
-  case (INT_CONST): cerr << " = " << cool_yylval.symbol;
+  case (INT_CONST): cerr << " = " << yylval.symbol;
 #ifdef CHECK_TABLES
-    inttable.lookup_string(cool_yylval.symbol->get_string());
+    inttable.lookup_string(yylval.symbol->get_string());
 #endif
     break;
-  case (BOOL_CONST): cerr << (cool_yylval.boolean ? " = true" : " = false"); break;
+  case (BOOL_CONST): cerr << (yylval.boolean ? " = true" : " = false"); break;
   case (TYPEID):
-  case (OBJECTID): cerr << " = " << cool_yylval.symbol;
+  case (OBJECTID): cerr << " = " << yylval.symbol;
 #ifdef CHECK_TABLES
-    idtable.lookup_string(cool_yylval.symbol->get_string());
+    idtable.lookup_string(yylval.symbol->get_string());
 #endif
     break;
   case (ERROR):
     cerr << " = ";
-    cerr << get_escaped_string(cool_yylval.error_msg);
+    cerr << get_escaped_string(yylval.error_msg);
     break;
   }
 }
 
+// a buffer for the escaped symbols of build_yaml_tree and build_binary_token
+static std::string escaped;
+
 // dump the token in format readable by the sceond phase token lexer
 // void dump_cool_token(ostream& out, int lineno, int token, YYSTYPE yylval)
 void build_yaml_tree(int lineno, int token, YYSTYPE yylval, ryml::NodeRef token_node) {
@@ -213,21 +347,23 @@ void build_yaml_tree(int lineno, int token, YYSTYPE yylval, ryml::NodeRef token_
   token_node["lineno"] << lineno;
 
   switch (token) {
-  case (STR_CONST): token_node["symbol"] << get_escaped_string(cool_yylval.symbol->get_string());
+  case (STR_CONST):
+    get_escaped_string(yylval.symbol->get_string(), escaped);
+    token_node["symbol"] << escaped;
 #ifdef CHECK_TABLES
-    stringtable.lookup_string(cool_yylval.symbol->get_string());
+    stringtable.lookup_string(yylval.symbol->get_string());
 #endif
     break;
-  case (INT_CONST): token_node["symbol"] << cool_yylval.symbol->get_string();
+  case (INT_CONST): token_node["symbol"] = to_csubstr(yylval.symbol);
 #ifdef CHECK_TABLES
-    inttable.lookup_string(cool_yylval.symbol->get_string());
+    inttable.lookup_string(yylval.symbol->get_string());
 #endif
     break;
-  case (BOOL_CONST): token_node["boolean"] << ryml::fmt::boolalpha(cool_yylval.boolean); break;
+  case (BOOL_CONST): token_node["boolean"] << ryml::fmt::boolalpha(yylval.boolean); break;
   case (TYPEID):
-  case (OBJECTID): token_node["symbol"] << cool_yylval.symbol->get_string();
+  case (OBJECTID): token_node["symbol"] = to_csubstr(yylval.symbol);
 #ifdef CHECK_TABLES
-    idtable.lookup_string(cool_yylval.symbol->get_string());
+    idtable.lookup_string(yylval.symbol->get_string());
 #endif
     break;
   case (ERROR):
@@ -236,11 +372,57 @@ void build_yaml_tree(int lineno, int token, YYSTYPE yylval, ryml::NodeRef token_
     // if we see an "empty" string here, we can safely assume the
     // lexer is reporting an occurrance of an illegal NUL in the
     // input stream
-    if (cool_yylval.error_msg[0] == 0) {
+    if (yylval.error_msg[0] == 0) {
       token_node["symbol"] << "\\000";
     } else {
-      token_node["symbol"] << get_escaped_string(cool_yylval.error_msg);
+      get_escaped_string(yylval.error_msg, escaped);
+      token_node["symbol"] << escaped;
       break;
     }
   }
 }
+
+//
+// The binary counterpart of build_yaml_tree: the symbol of each token is
+// the same text that the YAML stream would hold.
+//
+void build_binary_token(int lineno, int token, YYSTYPE yylval, binary_token_stream &tokens) {
+  binary_token rec = {token, (uint32_t)lineno, 0, 0};
+  std::string_view symbol;
+  switch (token) {
+  case (STR_CONST):
+    get_escaped_string(yylval.symbol->get_string(), escaped);
+    symbol = escaped;
+    break;
+  case (INT_CONST):
+  case (TYPEID):
+  case (OBJECTID): symbol = yylval.symbol->get_string(); break;
+  case (BOOL_CONST): rec.offset = yylval.boolean; break;
+  case (ERROR):
+    if (yylval.error_msg[0] == 0) {
+      symbol = "\\000";
+    } else {
+      get_escaped_string(yylval.error_msg, escaped);
+      symbol = escaped;
+    }
+    break;
+  }
+  if (!symbol.empty()) {
+    auto known = tokens.offsets.emplace(std::string(symbol), tokens.strings.size());
+    if (known.second) tokens.strings += symbol;
+    rec.offset = known.first->second;
+    rec.length = symbol.length();
+  }
+  tokens.records.push_back(rec);
+}
+
+void write_binary_tokens(ostream &out, const binary_token_stream &tokens) {
+  binary_token_header header;
+  memcpy(header.magic, BINARY_TOKEN_MAGIC, sizeof(header.magic));
+  header.count = tokens.records.size();
+  header.name_len = tokens.name_len;
+  header.strings_size = tokens.strings.size();
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)tokens.records.data(), tokens.records.size() * sizeof(binary_token));
+  out.write(tokens.strings.data(), tokens.strings.size());
+}
@@ -9,60 +9,36 @@
 #define _UTILITIES_H_
 
 #include "cool-io.h"
+#include "cool-yaml.h"
+#include <unordered_map>
 
 #include "ryml_all.hpp"
 
 const char *cool_token_to_string(int tok);
-void print_cool_token(int tok);
-std::string get_escaped_string(std::string s);
-std::string get_unescaped_string(std::string s);
+int cool_token_from_string(c4::csubstr kind);
+void get_escaped_string(std::string_view s, std::string &out);
+std::string get_escaped_string(std::string_view s);
+bool get_unescaped_string(std::string_view s, std::string &out, bool report = true);
+std::string get_unescaped_string(std::string_view s);
 
-#ifdef _COOL_PARSE_H
-static const std::unordered_map<std::string, int> string_to_cool_token = {
-    {"EOF", 0},
-    {"CLASS", CLASS},
-    {"ELSE", ELSE},
-    {"FI", FI},
-    {"IF", IF},
-    {"IN", IN},
-    {"INHERITS", INHERITS},
-    {"LET", LET},
-    {"LOOP", LOOP},
-    {"POOL", POOL},
-    {"THEN", THEN},
-    {"WHILE", WHILE},
-    {"ASSIGN", ASSIGN},
-    {"CASE", CASE},
-    {"ESAC", ESAC},
-    {"OF", OF},
-    {"DARROW", DARROW},
-    {"NEW", NEW},
-    {"STR_CONST", STR_CONST},
-    {"INT_CONST", INT_CONST},
-    {"BOOL_CONST", BOOL_CONST},
-    {"TYPEID", TYPEID},
-    {"OBJECTID", OBJECTID},
-    {"ERROR", ERROR},
-    {"LE", LE},
-    {"NOT", NOT},
-    {"ISVOID", ISVOID},
-    {"+", '+'},
-    {"/", '/'},
-    {"-", '-'},
-    {"*", '*'},
-    {"=", '='},
-    {"<", '<'},
-    {".", '.'},
-    {"~", '~'},
-    {",", ','},
-    {";", ';'},
-    {":", ':'},
-    {"(", '('},
-    {")", ')'},
-    {"@", '@'},
-    {"{", '{'},
-    {"}", '}'},
+#ifdef YYSTYPE_IS_DECLARED // the parts that need cool-parse.h
+//
+// The tokens of one file in the binary format of cool-yaml.h, gathered by
+// build_binary_token and written out by write_binary_tokens.  Symbols that
+// occur more than once are stored once.
+//
+struct binary_token_stream {
+  std::vector<binary_token> records;
+  std::string strings; // starts with the file name
+  uint32_t name_len;
+  std::unordered_map<std::string, uint32_t> offsets; // of symbols in strings
+
+  binary_token_stream(std::string_view filename) : strings(filename), name_len(filename.length()) {}
 };
+
+void print_cool_token(int tok, const YYSTYPE &yylval);
+void build_binary_token(int lineno, int token, YYSTYPE yylval, binary_token_stream &tokens);
+void write_binary_tokens(ostream &out, const binary_token_stream &tokens);
 #endif
 
 #endif